@@ -0,0 +1,601 @@
+#include <string>
+#include <vector>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <limits>
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <omp.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "external/CLI11.hpp"
+
+#include "kebab/kebab_index.hpp"
+#include "kebab/index_file.hpp"
+#include "kebab/nt_hash.hpp"
+#include "kebab/domain_hash.hpp"
+#include "kebab/bloom_filter.hpp"
+#include "kebab/blocked_bloom_filter.hpp"
+
+#include "constants.hpp"
+#include "util.hpp"
+
+// Micro benchmarks of the hashing and filter primitives, and an end-to-end scan of synthetic reads.
+// Every result is the best of several repeats and reports the time per operation (per thread for parallel runs),
+// throughput, reads/s for scans, and hardware cache misses per operation where perf events are available.
+
+/* =============================== MEASUREMENT =============================== */
+
+// Last level cache misses of the calling thread, unavailable (-1) without perf event access
+class CacheMissCounter {
+public:
+    CacheMissCounter() {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    ~CacheMissCounter() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    CacheMissCounter(const CacheMissCounter&) = delete;
+    CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+    void start() {
+        if (fd >= 0) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    int64_t stop() {
+        if (fd < 0) {
+            return -1;
+        }
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        int64_t count = 0;
+        return (read(fd, &count, sizeof(count)) == sizeof(count)) ? count : -1;
+    }
+
+private:
+    int fd;
+};
+
+// Keeps benchmarked results alive without affecting the loop being timed
+template<typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Result {
+    std::string name;
+    const char* unit;      // what one operation is
+    double ns_per_op;      // per thread
+    double ops_per_sec;    // across all threads
+    double reads_per_sec;  // scans only, otherwise negative
+    double misses_per_op;  // negative if cache misses couldn't be counted
+};
+
+class Report {
+public:
+    explicit Report(bool tsv) : tsv(tsv) {
+        if (tsv) {
+            printf("name\tunit\tns_per_op\tmops_per_sec\treads_per_sec\tcache_misses_per_op\n");
+        }
+        else {
+            printf("%-44s %14s %12s %14s %14s\n", "benchmark", "time", "throughput", "reads/s", "cache-miss/op");
+        }
+    }
+
+    void add(const Result& result) {
+        char reads[32] = "-";
+        char misses[32] = "-";
+        if (result.reads_per_sec >= 0) {
+            snprintf(reads, sizeof(reads), "%.0f", result.reads_per_sec);
+        }
+        if (result.misses_per_op >= 0) {
+            snprintf(misses, sizeof(misses), "%.3f", result.misses_per_op);
+        }
+
+        if (tsv) {
+            printf("%s\t%s\t%.3f\t%.3f\t%s\t%s\n", result.name.c_str(), result.unit, result.ns_per_op, result.ops_per_sec / 1e6,
+                   (result.reads_per_sec >= 0) ? reads : "", (result.misses_per_op >= 0) ? misses : "");
+        }
+        else {
+            char time_str[32];
+            snprintf(time_str, sizeof(time_str), "%.2f ns/%s", result.ns_per_op, result.unit);
+            printf("%-44s %14s %10.1f M/s %14s %14s\n", result.name.c_str(), time_str, result.ops_per_sec / 1e6, reads, misses);
+        }
+        fflush(stdout);
+    }
+
+private:
+    bool tsv;
+};
+
+struct BenchParams {
+    uint64_t ref_bases = 8'000'000;
+    uint64_t num_reads = 200'000;
+    uint64_t read_length = 150;
+    double mutation_rate = 0.01;      // chance of substituting each base of a read
+    double foreign_reads = 0.1;       // fraction of reads not drawn from the reference
+    uint64_t filter_keys = 16'000'000; // values inserted in the filters of the micro benchmarks
+    uint64_t micro_ops = 1ULL << 24;
+
+    uint16_t kmer_size = DEFAULT_KMER_SIZE;
+    KmerMode kmer_mode = DEFAULT_KMER_MODE;
+    double fp_rate = DEFAULT_FP_RATE;
+    uint16_t hash_funcs = DEFAULT_HASH_FUNCS;
+    FilterSizeMode filter_size_mode = DEFAULT_FILTER_SIZE_MODE;
+    FilterType filter_type = DEFAULT_FILTER_TYPE;
+    uint64_t min_mem_length = 40;
+
+    uint16_t threads = 1;
+    uint16_t repeats = 3;
+    uint64_t seed = 42;
+    std::string only;       // "micro" or "scan", empty runs both
+    std::string keep_fasta; // directory to write the synthetic reference and reads to
+    bool tsv = false;
+};
+
+// Runs body repeats times and keeps the fastest run, body returns the cache misses it counted (-1 if none)
+Result measure(const std::string& name, const char* unit, uint64_t ops, uint16_t threads, uint16_t repeats, const std::function<int64_t()>& body) {
+    double best_ns = std::numeric_limits<double>::max();
+    int64_t best_misses = -1;
+    for (uint16_t r = 0; r < repeats; ++r) {
+        const auto start = std::chrono::steady_clock::now();
+        int64_t misses = body();
+        const auto end = std::chrono::steady_clock::now();
+        double ns = std::chrono::duration<double, std::nano>(end - start).count();
+        if (ns < best_ns) {
+            best_ns = ns;
+            best_misses = misses;
+        }
+    }
+    return {
+        name,
+        unit,
+        best_ns * threads / ops,
+        ops / (best_ns / 1e9),
+        -1,
+        (best_misses >= 0) ? static_cast<double>(best_misses) / ops : -1
+    };
+}
+
+/* =============================== SYNTHETIC DATA =============================== */
+
+struct SyntheticData {
+    std::string reference;
+    std::string reads;             // concatenated
+    std::vector<size_t> read_starts; // num_reads + 1 offsets into reads
+    uint64_t read_kmers = 0;
+};
+
+void random_bases(std::mt19937_64& rng, char* out, size_t len) {
+    static constexpr char BASES[] = {'A', 'C', 'G', 'T'};
+    for (size_t i = 0; i < len; i += 32) {
+        uint64_t bits = rng();
+        for (size_t j = i; j < std::min(len, i + 32); ++j, bits >>= 2) {
+            out[j] = BASES[bits & 3];
+        }
+    }
+}
+
+char complement(char c) {
+    switch (c) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        case 'T': return 'A';
+        default: return c;
+    }
+}
+
+// Reads are sampled from either strand of the reference with random substitutions, plus some random (absent) reads
+SyntheticData generate_data(const BenchParams& params) {
+    if (params.ref_bases < params.read_length || params.read_length < params.kmer_size) {
+        error_exit("Reference must be at least one read long, and reads at least one k-mer long");
+    }
+    std::mt19937_64 rng(params.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+    SyntheticData data;
+    data.reference.resize(params.ref_bases);
+    random_bases(rng, data.reference.data(), data.reference.size());
+
+    data.reads.resize(params.num_reads * params.read_length);
+    data.read_starts.reserve(params.num_reads + 1);
+    for (uint64_t r = 0; r < params.num_reads; ++r) {
+        char* read = data.reads.data() + r * params.read_length;
+        data.read_starts.push_back(r * params.read_length);
+
+        if (unit(rng) < params.foreign_reads) {
+            random_bases(rng, read, params.read_length);
+            continue;
+        }
+        size_t pos = rng() % (params.ref_bases - params.read_length + 1);
+        const char* source = data.reference.data() + pos;
+        if (rng() & 1) {
+            std::copy(source, source + params.read_length, read);
+        }
+        else {
+            for (size_t i = 0; i < params.read_length; ++i) {
+                read[i] = complement(source[params.read_length - 1 - i]);
+            }
+        }
+        for (size_t i = 0; i < params.read_length; ++i) {
+            if (unit(rng) < params.mutation_rate) {
+                char substitute;
+                random_bases(rng, &substitute, 1);
+                read[i] = substitute;
+            }
+        }
+    }
+    data.read_starts.push_back(data.reads.size());
+    data.read_kmers = params.num_reads * (params.read_length - params.kmer_size + 1);
+    return data;
+}
+
+void write_fasta(const std::string& path, const std::string& seqs, const std::vector<size_t>& starts, const char* prefix) {
+    std::ofstream out(path);
+    if (!out) {
+        error_exit("Could not write " + path);
+    }
+    for (size_t i = 0; i + 1 < starts.size(); ++i) {
+        out << '>' << prefix << i << '\n';
+        out.write(seqs.data() + starts[i], starts[i + 1] - starts[i]);
+        out << '\n';
+    }
+}
+
+/* =============================== MICRO BENCHMARKS =============================== */
+
+void bench_nt_hash(const BenchParams& params, const std::string& seq, Report& report) {
+    const size_t k = params.kmer_size;
+    const uint64_t kmers = seq.size() - k + 1;
+
+    for (bool rev_comp : {false, true}) {
+        kebab::NtHash<> hasher(k, rev_comp);
+        std::string name = std::string("nthash/unsafe_roll/") + (rev_comp ? "canonical" : "forward");
+        report.add(measure(name, "k-mer", kmers, 1, params.repeats, [&]() -> int64_t {
+            CacheMissCounter counter;
+            counter.start();
+            hasher.set_sequence(seq.data(), seq.size());
+            uint64_t sum = hasher.hash_canonical();
+            for (uint64_t i = 1; i < kmers; ++i) {
+                hasher.unsafe_roll();
+                sum += hasher.hash_canonical();
+            }
+            do_not_optimize(sum);
+            return counter.stop();
+        }));
+    }
+
+    // The bulk kernels that scanning and building actually use
+    const kebab::HashKernel supported = kebab::detect_hash_kernel();
+    std::vector<uint64_t> hashes(HASH_BATCH_KMERS);
+    for (kebab::HashKernel kernel : {kebab::HashKernel::SCALAR, kebab::HashKernel::AVX2, kebab::HashKernel::AVX512}) {
+        if (kernel > supported) {
+            continue;
+        }
+        for (bool canonical : {false, true}) {
+            kebab::NtHash<> hasher(k, canonical);
+            std::string name = std::string("nthash/hash_all/") + kebab::hash_kernel_name(kernel) + "/" + (canonical ? "canonical" : "forward");
+            report.add(measure(name, "k-mer", kmers, 1, params.repeats, [&]() -> int64_t {
+                CacheMissCounter counter;
+                counter.start();
+                uint64_t sum = 0;
+                for (uint64_t first = 0; first < kmers; first += HASH_BATCH_KMERS) {
+                    const size_t count = std::min<uint64_t>(HASH_BATCH_KMERS, kmers - first);
+                    hasher.hash_all(seq.data() + first, count + k - 1, hashes.data(), nullptr, canonical, kernel);
+                    sum += hashes[count - 1];
+                }
+                do_not_optimize(sum);
+                return counter.stop();
+            }));
+        }
+    }
+}
+
+template<typename Hash>
+void bench_domain_hash(const char* name, const BenchParams& params, const std::vector<uint64_t>& values, Report& report) {
+    // Domain of a filter sized for the micro benchmark keys
+    const Hash hash(kebab::optimal_bits(params.filter_keys, params.fp_rate));
+    report.add(measure(std::string("domain_hash/") + name, "hash", values.size(), 1, params.repeats, [&]() -> int64_t {
+        CacheMissCounter counter;
+        counter.start();
+        uint64_t sum = 0;
+        for (size_t i = 0; i < values.size(); ++i) {
+            sum += hash(values[i], SEEDS[i & 3]);
+        }
+        do_not_optimize(sum);
+        return counter.stop();
+    }));
+}
+
+template<typename Filter>
+void bench_filter(const char* name, FilterSizeMode filter_size_mode, const BenchParams& params, const std::vector<uint64_t>& keys, const std::vector<uint64_t>& queries, Report& report) {
+    Filter bf(keys.size(), params.fp_rate, params.hash_funcs, filter_size_mode);
+    for (uint64_t key : keys) {
+        bf.add(key);
+    }
+
+    size_t contains_hits = 0;
+    report.add(measure(std::string("filter/") + name + "/contains", "lookup", queries.size(), 1, params.repeats, [&]() -> int64_t {
+        CacheMissCounter counter;
+        counter.start();
+        size_t hits = 0;
+        for (uint64_t query : queries) {
+            hits += bf.contains(query);
+        }
+        do_not_optimize(hits);
+        contains_hits = hits;
+        return counter.stop();
+    }));
+
+    // Same ring as KebabIndex::scan_read_prefetch
+    const size_t distance = PREFETCH_DISTANCE / bf.get_lines_per_lookup();
+    std::vector<typename Filter::PrefetchInfo> ring(distance, typename Filter::PrefetchInfo(bf.get_num_hashes()));
+    size_t prefetch_hits = 0;
+    report.add(measure(std::string("filter/") + name + "/check_prefetch", "lookup", queries.size(), 1, params.repeats, [&]() -> int64_t {
+        CacheMissCounter counter;
+        counter.start();
+        size_t hits = 0;
+        size_t slot = 0;
+        for (size_t i = 0; i < queries.size(); ++i) {
+            if (i >= distance) {
+                hits += bf.check_prefetch(ring[slot]);
+            }
+            bf.prefetch_words(queries[i], ring[slot]);
+            slot = (slot + 1 == distance) ? 0 : slot + 1;
+        }
+        for (size_t i = 0; i < std::min(distance, queries.size()); ++i) {
+            hits += bf.check_prefetch(ring[slot]);
+            slot = (slot + 1 == distance) ? 0 : slot + 1;
+        }
+        do_not_optimize(hits);
+        prefetch_hits = hits;
+        return counter.stop();
+    }));
+
+    if (contains_hits != prefetch_hits) {
+        error_exit(std::string(name) + ": contains and check_prefetch disagree (" + std::to_string(contains_hits) + " vs " + std::to_string(prefetch_hits) + ")");
+    }
+}
+
+void run_micro(const BenchParams& params, const SyntheticData& data, Report& report) {
+    std::mt19937_64 rng(params.seed + 1);
+
+    std::string seq(std::min<uint64_t>(data.reference.size(), params.micro_ops + params.kmer_size - 1), 'A');
+    std::copy(data.reference.begin(), data.reference.begin() + seq.size(), seq.begin());
+    bench_nt_hash(params, seq, report);
+
+    std::vector<uint64_t> values(params.micro_ops);
+    for (uint64_t& value : values) {
+        value = rng();
+    }
+    bench_domain_hash<kebab::MultiplyShift>("MultiplyShift", params, values, report);
+    bench_domain_hash<kebab::MultiplyMod>("MultiplyMod", params, values, report);
+    bench_domain_hash<kebab::NtManyShift>("NtManyShift", params, values, report);
+    bench_domain_hash<kebab::NtManyMod>("NtManyMod", params, values, report);
+    bench_domain_hash<kebab::MurmurShift>("MurmurShift", params, values, report);
+    bench_domain_hash<kebab::MurmurMod>("MurmurMod", params, values, report);
+
+    // Half the queries are present, like reads mostly drawn from the reference
+    std::vector<uint64_t> keys(params.filter_keys);
+    for (uint64_t& key : keys) {
+        key = rng();
+    }
+    std::vector<uint64_t> queries(params.micro_ops);
+    for (uint64_t& query : queries) {
+        query = (rng() & 1) ? keys[rng() % keys.size()] : rng();
+    }
+    bench_filter<kebab::ShiftFilter>("ShiftFilter", FilterSizeMode::PREVIOUS_POWER_OF_TWO, params, keys, queries, report);
+    bench_filter<kebab::ModFilter>("ModFilter", FilterSizeMode::EXACT, params, keys, queries, report);
+    bench_filter<kebab::BlockedShiftFilter>("BlockedShiftFilter", FilterSizeMode::PREVIOUS_POWER_OF_TWO, params, keys, queries, report);
+    bench_filter<kebab::BlockedModFilter>("BlockedModFilter", FilterSizeMode::EXACT, params, keys, queries, report);
+}
+
+/* =============================== END TO END =============================== */
+
+template<typename Index>
+void bench_scan(const BenchParams& params, const SyntheticData& data, Report& report) {
+    const size_t k = params.kmer_size;
+    const uint64_t ref_kmers = data.reference.size() - k + 1;
+    const uint64_t expected_kmers = (params.kmer_mode == KmerMode::BOTH_STRANDS) ? 2 * ref_kmers : ref_kmers;
+
+    // Reference chunks overlap by k - 1 so every k-mer is added once, inserted through per-thread build contexts like the CLI
+    static constexpr size_t BUILD_CHUNK = 1ULL << 20;
+    const size_t num_chunks = (data.reference.size() + BUILD_CHUNK - 1) / BUILD_CHUNK;
+    std::unique_ptr<Index> index;
+    report.add(measure("scan/build", "k-mer", ref_kmers, params.threads, params.repeats, [&]() -> int64_t {
+        index = std::make_unique<Index>(k, expected_kmers, params.fp_rate, params.hash_funcs, params.kmer_mode, params.filter_size_mode);
+        std::vector<typename Index::BuildContext> contexts(params.threads);
+        int64_t misses = 0;
+        #pragma omp parallel num_threads(params.threads) reduction(+:misses)
+        {
+            CacheMissCounter counter;
+            counter.start();
+            #pragma omp for schedule(dynamic)
+            for (size_t c = 0; c < num_chunks; ++c) {
+                const size_t begin = c * BUILD_CHUNK;
+                const size_t end = std::min(data.reference.size(), begin + BUILD_CHUNK + k - 1);
+                index->add_sequence(data.reference.data() + begin, end - begin, contexts[omp_get_thread_num()]);
+            }
+            misses += counter.stop();
+        }
+        index->finish_build(contexts);
+        return misses;
+    }));
+    // Reads handed to each thread at a time, also the batch size of batched scans
+    static constexpr size_t SCAN_CHUNK = 1024;
+    std::istringstream stats(index->get_stats());
+    for (std::string line; std::getline(stats, line); ) {
+        printf("#%s\n", line.c_str());
+    }
+
+    // Per read without and with prefetching, then whole chunks of reads through one prefetch ring
+    const char* SCAN_MODES[] = {"direct", "prefetch", "batch"};
+    uint64_t fragments_found[3] = {0, 0, 0};
+    for (size_t mode = 0; mode < 3; ++mode) {
+        const bool prefetch = mode > 0;
+        Result result = measure(std::string("scan/") + SCAN_MODES[mode], "k-mer", data.read_kmers, params.threads, params.repeats, [&]() -> int64_t {
+            int64_t misses = 0;
+            uint64_t fragments = 0;
+            #pragma omp parallel num_threads(params.threads) reduction(+:misses, fragments)
+            {
+                typename Index::ScanContext context;
+                std::vector<kebab::Sequence> batch;
+                CacheMissCounter counter;
+                counter.start();
+                #pragma omp for schedule(dynamic)
+                for (size_t first = 0; first < params.num_reads; first += SCAN_CHUNK) {
+                    const size_t last = std::min(params.num_reads, first + SCAN_CHUNK);
+                    if (mode == 2) {
+                        batch.clear();
+                        for (size_t r = first; r < last; ++r) {
+                            batch.push_back({data.reads.data() + data.read_starts[r], data.read_starts[r + 1] - data.read_starts[r]});
+                        }
+                        index->scan_batch(batch.data(), batch.size(), context, params.min_mem_length, DEFAULT_REMOVE_OVERLAPS, prefetch);
+                        fragments += context.get_batch_fragments().size();
+                        continue;
+                    }
+                    for (size_t r = first; r < last; ++r) {
+                        const size_t start = data.read_starts[r];
+                        index->scan_read(data.reads.data() + start, data.read_starts[r + 1] - start, context, params.min_mem_length, DEFAULT_REMOVE_OVERLAPS, prefetch);
+                        fragments += context.get_fragments().size();
+                    }
+                }
+                misses += counter.stop();
+            }
+            fragments_found[mode] = fragments;
+            return misses;
+        });
+        result.reads_per_sec = result.ops_per_sec * params.num_reads / data.read_kmers;
+        report.add(result);
+    }
+
+    if (fragments_found[0] != fragments_found[1] || fragments_found[0] != fragments_found[2]) {
+        error_exit("Scan modes disagree (" + std::to_string(fragments_found[0]) + " direct, " + std::to_string(fragments_found[1]) + " prefetched, "
+                   + std::to_string(fragments_found[2]) + " batched fragments)");
+    }
+    printf("# %lu fragments of at least %lu bases in %lu reads\n", fragments_found[0], params.min_mem_length, params.num_reads);
+}
+
+/* =============================== MAIN =============================== */
+
+int main(int argc, char** argv) {
+    CLI::App app{"KeBaB benchmarks: hashing and filter micro benchmarks, and scanning synthetic reads"};
+    app.set_version_flag("--version", "KeBaB " + std::string(VERSION));
+    app.failure_message(CLI::FailureMessage::help);
+
+    BenchParams params;
+    bool no_filter_rounding = false;
+    app.add_option("--ref-bases", params.ref_bases, "Length of the synthetic reference")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--reads", params.num_reads, "Number of synthetic reads")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--read-length", params.read_length, "Length of each read")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--mutation-rate", params.mutation_rate, "Chance of substituting each base of a read")
+        ->capture_default_str()
+        ->check(CLI::Range(0.0, 1.0));
+    app.add_option("--foreign-reads", params.foreign_reads, "Fraction of random reads not drawn from the reference")
+        ->capture_default_str()
+        ->check(CLI::Range(0.0, 1.0));
+    app.add_option("--filter-keys", params.filter_keys, "Values in the filters of the micro benchmarks")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--micro-ops", params.micro_ops, "Operations per micro benchmark")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("-k,--kmer-size", params.kmer_size, "K-mer size")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--kmer-mode", params.kmer_mode, "K-mer strands to include in the index")
+        ->capture_default_str()
+        ->transform(CLI::CheckedTransformer(std::map<std::string, KmerMode>{
+            {"both", KmerMode::BOTH_STRANDS},
+            {"canonical", KmerMode::CANONICAL_ONLY},
+            {"forward", KmerMode::FORWARD_ONLY}
+        }, CLI::ignore_case));
+    app.add_option("-e,--fp-rate", params.fp_rate, "Desired false positive rate (between 0 and 1)")
+        ->capture_default_str()
+        ->check(CLI::Range(0.0, 1.0));
+    app.add_option("-f,--hash-funcs", params.hash_funcs, "Number of hash functions (otherwise set to minimize index size)")
+        ->check(CLI::PositiveNumber);
+    app.add_flag("--no-rounding", no_filter_rounding, "Don't round to power of 2 for filter size");
+    app.add_option("--filter-type", params.filter_type, "Bloom filter layout of the scanned index")
+        ->capture_default_str()
+        ->transform(CLI::CheckedTransformer(std::map<std::string, FilterType>{
+            {"standard", FilterType::STANDARD},
+            {"blocked", FilterType::BLOCKED}
+        }, CLI::ignore_case));
+    app.add_option("-l,--mem-length", params.min_mem_length, "Minimum MEM length of the scan")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("-t,--threads", params.threads, "Threads for building and scanning (micro benchmarks are single threaded)")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--repeats", params.repeats, "Runs of each benchmark, the fastest is reported")
+        ->capture_default_str()
+        ->check(CLI::PositiveNumber);
+    app.add_option("--seed", params.seed, "Seed of the synthetic data")
+        ->capture_default_str();
+    app.add_option("--only", params.only, "Run only one group of benchmarks")
+        ->check(CLI::IsMember({"micro", "scan"}));
+    app.add_option("--keep-fasta", params.keep_fasta, "Directory to write the synthetic reference and reads to, to time the CLI on them")
+        ->check(CLI::ExistingDirectory);
+    app.add_flag("--tsv", params.tsv, "Tab separated output for comparing runs");
+
+    CLI11_PARSE(app, argc, argv);
+
+    if (no_filter_rounding) {
+        params.filter_size_mode = FilterSizeMode::EXACT;
+    }
+    if (params.min_mem_length <= params.kmer_size) {
+        error_exit("Minimum MEM length (" + std::to_string(params.min_mem_length) + ") must be greater than k-mer size (" + std::to_string(params.kmer_size) + ")");
+    }
+
+    SyntheticData data = generate_data(params);
+    if (!params.keep_fasta.empty()) {
+        write_fasta(params.keep_fasta + "/bench_ref.fa", data.reference, {0, data.reference.size()}, "ref");
+        write_fasta(params.keep_fasta + "/bench_reads.fa", data.reads, data.read_starts, "read");
+    }
+
+    printf("# k=%u reference=%lu reads=%lux%lu threads=%u hash kernel=%s\n", params.kmer_size, params.ref_bases, params.num_reads,
+           params.read_length, params.threads, kebab::hash_kernel_name(kebab::detect_hash_kernel()));
+    if (CacheMissCounter().stop() < 0) {
+        printf("# cache misses unavailable (perf events not permitted, see /proc/sys/kernel/perf_event_paranoid)\n");
+    }
+    Report report(params.tsv);
+
+    if (params.only.empty() || params.only == "micro") {
+        run_micro(params, data, report);
+    }
+    if (params.only.empty() || params.only == "scan") {
+        kebab::visit_index_type(params.filter_type, params.filter_size_mode, [&](auto tag) {
+            bench_scan<typename decltype(tag)::type>(params, data, report);
+        });
+    }
+
+    return 0;
+}
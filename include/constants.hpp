@@ -5,7 +5,23 @@ static constexpr const char* VERSION = "1.0.1";
 
 // I/O
 static constexpr size_t DEFAULT_BUFFER_SIZE = 64ULL * 1024ULL * 1024ULL; // 64MB
+static constexpr size_t SEQ_BATCH_BYTES = 1ULL * 1024ULL * 1024ULL; // 1MB of records handed to a worker at once
+static constexpr size_t SEQ_BATCH_MAX_RETAINED = 16 * SEQ_BATCH_BYTES; // release arenas grown larger than this by long records
+static constexpr size_t SEQ_BATCHES_PER_THREAD = 2; // batches in flight per worker, lets the reader run ahead
+static constexpr size_t SEQ_CHUNK_BASES = SEQ_BATCH_BYTES; // longer records are split into chunks of this many new bases, one per batch
+static constexpr size_t INPUT_CHUNK_BYTES = 4ULL * 1024ULL * 1024ULL; // 4MB of decompressed gzip input produced at once
+static constexpr size_t GZIP_READ_BYTES = 1ULL * 1024ULL * 1024ULL; // compressed bytes read at once from a gzip file
+static constexpr size_t BGZF_CHUNK_BYTES = 1ULL * 1024ULL * 1024ULL; // whole BGZF blocks (~1MB compressed) inflated by one thread at once
+static constexpr size_t INPUT_CHUNKS_PER_THREAD = 2; // decompressed chunks in flight per decompression thread
 static constexpr const char* KEBAB_FILE_SUFFIX = ".kbb";
+static constexpr const char* FRAGMENT_FILE_SUFFIX = ".kbf";
+static constexpr uint32_t FRAGMENT_FILE_MAGIC = 0x0146424B; // "KBF\x01"
+static constexpr uint32_t FRAGMENT_FILE_VERSION = 1;
+static constexpr const char* SPOOL_FILE_SUFFIX = ".spool"; // temporary, unlinked as soon as it is created
+static constexpr uint32_t KEBAB_FILE_MAGIC = 0x0142424B; // "KBB\x01", absent in legacy (v1.0.1) indexes
+static constexpr uint32_t KEBAB_FILE_VERSION = 3;
+static constexpr uint32_t ALIGNED_PAYLOAD_VERSION = 3; // first version with page-aligned (mappable) filter payloads
+static constexpr size_t FILTER_PAYLOAD_ALIGNMENT = 4096; // page size
 
 // K-mer Mode
 enum class KmerMode {
@@ -13,8 +29,18 @@ enum class KmerMode {
     CANONICAL_ONLY,        // Use canonical form of each k-mer
     FORWARD_ONLY           // Only use forward k-mers
 };
-inline bool use_build_rev_comp(KmerMode mode) { return mode == KmerMode::BOTH_STRANDS || mode == KmerMode::CANONICAL_ONLY; }
-inline bool use_scan_rev_comp(KmerMode mode) { return mode == KmerMode::CANONICAL_ONLY; }
+static constexpr size_t NUM_KMER_MODES = 3;
+constexpr bool use_build_rev_comp(KmerMode mode) { return mode == KmerMode::BOTH_STRANDS || mode == KmerMode::CANONICAL_ONLY; }
+constexpr bool use_scan_rev_comp(KmerMode mode) { return mode == KmerMode::CANONICAL_ONLY; }
+// Name given to --kmer-mode
+constexpr const char* kmer_mode_name(KmerMode mode) {
+    switch (mode) {
+        case KmerMode::BOTH_STRANDS: return "both";
+        case KmerMode::CANONICAL_ONLY: return "canonical";
+        case KmerMode::FORWARD_ONLY: return "forward";
+    }
+    return "unknown";
+}
 static constexpr bool DEFAULT_REVERSE_COMPLEMENT = true;
 
 // Filter Size Mode
@@ -26,13 +52,46 @@ enum class FilterSizeMode {
 inline bool use_shift_filter(FilterSizeMode mode) { return mode == FilterSizeMode::NEXT_POWER_OF_TWO || mode == FilterSizeMode::PREVIOUS_POWER_OF_TWO; }
 static constexpr double ROUND_THRESHOLD = 0.10; // 10% tolerance to round to the nearest power of two despite mode
 
+// Filter Layout
+enum class FilterType {
+    STANDARD,              // Each hash probes an independent word of the filter
+    BLOCKED                // All hashes probe a single cache-line block
+};
+
 // ESTIMATE
 static constexpr uint64_t HLL_SIZE = 20; // 2^20 bytes
+static constexpr const char* SKETCH_FILE_SUFFIX = ".hll"; // saved beside the input, per k and k-mer mode
+static constexpr uint32_t SKETCH_FILE_MAGIC = 0x0153424B; // "KBS\x01"
+static constexpr uint32_t SKETCH_FILE_VERSION = 1;
+static constexpr bool DEFAULT_SKETCH_CACHE = true;
+
+// HASHING
+static constexpr size_t HASH_BATCH_KMERS = 1024; // k-mers hashed per bulk call when streaming over a sequence
+
+// SPECIALISATION
+static constexpr size_t MAX_SPECIALISED_HASHES = 4; // scan and build kernels are compiled per hash count up to this, larger counts loop at runtime
+
+// STATS
+static constexpr size_t STATS_ALIGNMENT = 64; // per-thread counters are padded to a cache line
 
 // LATENCY HIDING
-static constexpr uint64_t PREFETCH_DISTANCE = 32; // prefetch this many read operations on the bloom filter
+static constexpr uint64_t PREFETCH_DISTANCE = 32; // prefetch this many read operations on the bloom filter, unless tuned
+
+// TUNE
+static constexpr const char* TUNE_FILE_SUFFIX = ".tune"; // saved beside the index
+static constexpr uint32_t TUNE_FILE_MAGIC = 0x0154424B; // "KBT\x01"
+static constexpr uint32_t TUNE_FILE_VERSION = 1;
+static constexpr size_t TUNE_MAX_CPU_NAME = 256;
+static constexpr size_t TUNE_SAMPLE_BASES = 4ULL * 1024ULL * 1024ULL; // bases of reads scanned per measurement
+static constexpr size_t TUNE_SAMPLE_READ_LENGTH = 150; // of random reads, when none are given
+static constexpr size_t TUNE_REPEATS = 3; // measurements per setting, the fastest counts
+static constexpr size_t TUNE_PREFETCH_DISTANCES[] = {0, 4, 8, 16, 32, 64, 128}; // filter cache lines kept in flight to try, 0 scans without prefetching
+static constexpr double TUNE_THREAD_TOLERANCE = 0.05; // fewer threads are preferred unless more are this much faster
+static constexpr bool DEFAULT_USE_TUNING = true;
 
 // BUILD
+static constexpr size_t BUILD_PARTITIONS = 512; // filter regions a parallel build radix-partitions its bits into
+static constexpr size_t BUILD_PARTITION_BUFFER = 64; // bits a thread buffers per region before applying them under the region's lock
 static constexpr uint16_t DEFAULT_KMER_SIZE = 20;
 static constexpr KmerMode DEFAULT_KMER_MODE = KmerMode::CANONICAL_ONLY;
 static constexpr double DEFAULT_FP_RATE = 0.1;
@@ -40,6 +99,13 @@ static constexpr uint16_t DEFAULT_HASH_FUNCS = 0; // 0 means optimal number of h
 static constexpr uint64_t DEFAULT_EXPECTED_KMERS = 0; // 0 means use hyperloglog to estimate number of k-mers
 static constexpr uint16_t DEFAULT_BUILD_THREADS = 8; // overridden by call to omp_get_max_threads()
 static constexpr FilterSizeMode DEFAULT_FILTER_SIZE_MODE = FilterSizeMode::PREVIOUS_POWER_OF_TWO;
+static constexpr FilterType DEFAULT_FILTER_TYPE = FilterType::STANDARD;
+static constexpr bool DEFAULT_SINGLE_PASS = false;
+static constexpr uint64_t DEFAULT_SPOOL_MEMORY = 4096; // MB of k-mer hashes a single pass build keeps in memory before spilling to disk
+
+// MERGE / APPEND / FOLD
+static constexpr double DEFAULT_MAX_FP_RATE = 2 * DEFAULT_FP_RATE; // observed FP rate past which a merged, appended or folded index warns
+static constexpr size_t DEFAULT_FOLDS = 1; // times fold halves the filter, unless given a size to fit
 
 // SCAN
 static constexpr uint64_t DEFAULT_MIN_MEM_LENGTH = 25;
@@ -47,6 +113,15 @@ static constexpr uint16_t DEFAULT_TOP_T = 0; // 0 means no top-t filtering
 static constexpr bool DEFAULT_SORT_FRAGMENTS = false;
 static constexpr bool DEFAULT_REMOVE_OVERLAPS = false;
 static constexpr bool DEFAULT_PREFETCH = true;
+static constexpr bool DEFAULT_SKIP_AHEAD = false;
+static constexpr bool DEFAULT_ORDERED_OUTPUT = false;
+static constexpr bool DEFAULT_KEEP_QUALITIES = false;
+static constexpr bool DEFAULT_BINARY_OUTPUT = false;
+static constexpr bool DEFAULT_PACK_SEQUENCES = false;
+static constexpr bool DEFAULT_MMAP = true;
+static constexpr bool DEFAULT_POPULATE = false;
+static constexpr bool DEFAULT_HUGE_PAGES = false;
+static constexpr size_t DEFAULT_SCAN_FOLDS = 0; // times a scan halves the filter once loaded
 static constexpr uint16_t DEFAULT_SCAN_THREADS = 8; // overridden by call to omp_get_max_threads()
 
 #endif
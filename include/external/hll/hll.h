@@ -32,6 +32,7 @@ SOFTWARE.
 #include <cstdlib>
 #include <string>
 #include <vector>
+#include <iostream>
 #include "external/hll/logutil.h"
 #include "external/hll/sseutil.h"
 
@@ -44,7 +45,12 @@ SOFTWARE.
 #endif
 
 #include "x86intrin.h"
-#define HAS_AVX_512 _FEATURE_AVX512F
+// Register max/min need byte lanes, which AVX-512 only has with BW
+#ifdef __AVX512BW__
+#  define HAS_AVX_512 1
+#else
+#  define HAS_AVX_512 0
+#endif
 
 namespace hll {
 
@@ -216,7 +222,8 @@ public:
     std::string desc_string() const;
 
     INLINE void add(std::uint64_t hashval) {
-        const std::uint32_t index(hashval >> (64u - np_)), lzt(clz(hashval << np_) + 1);
+        // The sentinel bit caps the rank at 64 - np + 1 and keeps clz's argument non-zero
+        const std::uint32_t index(hashval >> (64u - np_)), lzt(clz((hashval << np_) | (1ull << (np_ - 1))) + 1);
 #if THREADSAFE
         while(core_[index] < lzt)
             __sync_bool_compare_and_swap(core_.data() + index, core_[index], lzt);
@@ -237,6 +244,10 @@ public:
     hll_t const &operator+=(const hll_t &other);
     hll_t const &operator&=(const hll_t &other);
 
+    // Raw registers, read back only into a sketch of the same np
+    void write(std::ostream &out) const;
+    void read(std::istream &in);
+
     // Clears, allows reuse with different np.
     void resize(std::size_t new_size);
     // Getter for is_calculated_
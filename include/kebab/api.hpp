@@ -0,0 +1,74 @@
+#ifndef KEBAB_API_HPP
+#define KEBAB_API_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "constants.hpp"
+
+#include "kebab/fragment.hpp"
+
+// Stable interface of libkebab, for scanning sequences in memory from another program.
+// Hides the filter layout an index was built with, so only this header, fragment.hpp and constants.hpp are needed.
+
+namespace kebab {
+
+struct OpenOptions {
+    bool mmap = DEFAULT_MMAP;             // Query the filter in place from the page cache (falls back to reading it in)
+    bool populate = DEFAULT_POPULATE;     // Pre-fault the whole mapping
+    bool huge_pages = DEFAULT_HUGE_PAGES; // Ask for transparent huge pages for the mapping
+};
+
+struct ScanOptions {
+    uint64_t min_mem_length = DEFAULT_MIN_MEM_LENGTH; // Must be greater than the index's k
+    bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS;
+    bool prefetch = DEFAULT_PREFETCH;
+    bool skip_ahead = DEFAULT_SKIP_AHEAD;             // Same fragments from fewer queries when most reads are absent
+    bool sort = DEFAULT_SORT_FRAGMENTS;               // Longest fragments first
+    size_t top_t = DEFAULT_TOP_T;                     // Keep only the top_t longest fragments (requires sort), 0 keeps all
+};
+
+// Receives every fragment of a batch in sequence order, seq_index is the sequence's position in the batch
+using FragmentCallback = std::function<void(size_t seq_index, const Fragment& fragment)>;
+
+// A loaded KeBaB index. Scans are const and may run concurrently from any number of threads.
+// Scans throw std::invalid_argument if min_mem_length is not greater than k.
+class Index {
+public:
+    // Throws std::runtime_error if the index cannot be read
+    static Index open(const std::string& path, const OpenOptions& options = OpenOptions());
+
+    ~Index();
+    Index(Index&& other) noexcept;
+    Index& operator=(Index&& other) noexcept;
+
+    size_t get_k() const noexcept;
+    KmerMode get_kmer_mode() const noexcept;
+    bool is_mapped() const noexcept;
+    std::string get_stats() const;
+
+    // Writes up to capacity fragments of seq to out and returns how many it has in total,
+    // so a result larger than capacity means the buffer was too small
+    size_t scan(const char* seq, size_t len, Fragment* out, size_t capacity, const ScanOptions& options = ScanOptions()) const;
+
+    // Scans count sequences into caller-owned storage, reused across calls without reallocating once large enough.
+    // Fragments of sequence i are fragments[offsets[i]] up to fragments[offsets[i + 1]], offsets has count + 1 entries.
+    void scan_batch(const Sequence* seqs, size_t count, std::vector<Fragment>& fragments, std::vector<size_t>& offsets, const ScanOptions& options = ScanOptions()) const;
+
+    // Same, handing fragments to a callback instead of storing them. The callback must not scan on the same thread.
+    void scan_batch(const Sequence* seqs, size_t count, const FragmentCallback& on_fragment, const ScanOptions& options = ScanOptions()) const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+
+    explicit Index(std::unique_ptr<Impl> impl);
+};
+
+} // namespace kebab
+
+#endif // KEBAB_API_HPP
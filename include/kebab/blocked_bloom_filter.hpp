@@ -0,0 +1,296 @@
+#ifndef BLOCKED_BLOOM_FILTER_H
+#define BLOCKED_BLOOM_FILTER_H
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+#include <omp.h>
+
+#include "constants.hpp"
+
+#include "kebab/domain_hash.hpp"
+#include "kebab/filter_storage.hpp"
+#include "kebab/bloom_filter.hpp"
+
+namespace kebab {
+
+// One block per cache line, every probe for a value lands inside the same block
+static constexpr size_t BLOCK_BITS = 512;
+static constexpr size_t WORDS_PER_BLOCK = BLOCK_BITS / BITS_PER_WORD;
+static constexpr size_t BLOCK_BIT_SHIFT = 64 - 9; // top log2(BLOCK_BITS) bits of a hash select the bit within a block
+
+struct alignas(BLOCK_BITS / CHAR_BIT) Block {
+    word_t words[WORDS_PER_BLOCK];
+};
+
+struct BlockPrefetchInfo {
+    uint64_t val;
+    const Block* block;
+
+    BlockPrefetchInfo(size_t /* num_hashes */) : val(0), block(nullptr) {}
+};
+
+// Blocked Bloom filter: the first seed picks a block, the remaining num_hashes seeds pick bits within it.
+// A lookup therefore costs a single cache miss regardless of the number of hashes.
+template<typename Hash = MultiplyShift>
+class BlockedBloomFilter {
+public:
+    using PrefetchInfo = BlockPrefetchInfo;
+
+    BlockedBloomFilter() : num_elements(0), error_rate(0), bits(0), set_bits(0), filter(), num_hashes(0), hash() {}
+
+    BlockedBloomFilter(size_t elements, double error_rate = DEFAULT_FP_RATE, size_t num_hashes = DEFAULT_HASH_FUNCS, FilterSizeMode filter_size_mode = DEFAULT_FILTER_SIZE_MODE) {
+        init(elements, error_rate, num_hashes, filter_size_mode);
+    }
+
+    template<size_t NumHashes = 0>
+    void add(uint64_t val) {
+        Block& block = filter[hash(val, SEEDS[0])];
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
+            uint64_t bit = get_block_bit(val, i);
+            word_t* word = &block.words[bit / BITS_PER_WORD];
+            word_t bit_mask = get_bit_mask(bit);
+
+            // Ensure that word is updated atomically for thread safety
+            word_t old_val;
+            #pragma omp atomic capture
+            {
+                old_val = *word;
+                *word |= bit_mask;
+            }
+            if (!(old_val & bit_mask)) {
+                #pragma omp atomic
+                set_bits++;
+            }
+        }
+    }
+
+    template<size_t NumHashes = 0>
+    bool contains(uint64_t val) const {
+        return check_block<NumHashes>(filter[hash(val, SEEDS[0])], val);
+    }
+
+    template<size_t NumHashes = 0>
+    void prefetch_words(uint64_t val, PrefetchInfo& info) const {
+        info.val = val;
+        info.block = &filter[hash(val, SEEDS[0])];
+        L1_PREFETCH(info.block);
+    }
+
+    template<size_t NumHashes = 0>
+    bool check_prefetch(const PrefetchInfo& info) const {
+        return check_block<NumHashes>(*info.block, info.val);
+    }
+
+    // Calls visit(bit) for each filter bit val sets, numbered across blocks, for callers that partition insertions instead of calling add
+    template<size_t NumHashes = 0, typename Visitor>
+    void for_each_bit(uint64_t val, Visitor visit) const {
+        const uint64_t block_start = hash(val, SEEDS[0]) * BLOCK_BITS;
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
+            visit(block_start + get_block_bit(val, i));
+        }
+    }
+
+    // Not synchronised: the caller must be the only thread writing the bit's word. Leaves set_bits stale until count_set_bits.
+    void set_bit(uint64_t bit) noexcept {
+        filter[bit / BLOCK_BITS].words[(bit % BLOCK_BITS) / BITS_PER_WORD] |= get_bit_mask(bit);
+    }
+
+    // A single memory bound pass, cheap next to building the filter
+    void count_set_bits() {
+        size_t count = 0;
+        const Block* blocks = filter.data();
+        for (size_t i = 0; i < filter.size(); ++i) {
+            for (size_t j = 0; j < WORDS_PER_BLOCK; ++j) {
+                count += __builtin_popcountll(blocks[i].words[j]);
+            }
+        }
+        set_bits = count;
+    }
+
+    size_t get_bits() const {
+        return bits;
+    }
+
+    size_t get_num_hashes() const {
+        return num_hashes;
+    }
+
+    size_t get_lines_per_lookup() const {
+        return 1;
+    }
+
+    // Chance an absent value is reported present, from the fraction of bits set (ignores uneven block loads)
+    double get_fp_rate() const {
+        return std::pow(static_cast<double>(set_bits) / bits, num_hashes);
+    }
+
+    // ORs in a filter of the same size and hash count, which then holds the values of both.
+    // Throws std::invalid_argument if they differ, the filter must not be memory-mapped.
+    void merge(const BlockedBloomFilter& other) {
+        if (bits != other.bits || num_hashes != other.num_hashes) {
+            throw std::invalid_argument("Filters differ in size or hash count (" + std::to_string(bits) + " bits, " + std::to_string(num_hashes) + " hashes vs "
+                                        + std::to_string(other.bits) + " bits, " + std::to_string(other.num_hashes) + " hashes)");
+        }
+        if (filter.is_mapped()) {
+            throw std::runtime_error("Cannot merge into a memory-mapped filter");
+        }
+        Block* blocks = filter.data();
+        const Block* other_blocks = other.filter.data();
+        for (size_t i = 0; i < filter.size(); ++i) {
+            for (size_t j = 0; j < WORDS_PER_BLOCK; ++j) {
+                blocks[i].words[j] |= other_blocks[i].words[j];
+            }
+        }
+        count_set_bits();
+    }
+
+    // Halves the filter, which still holds every value but at a higher false positive rate. The block is the top bits of
+    // a hash, so with one bit fewer blocks 2i and 2i + 1 become block i, while bits within a block don't change.
+    // A memory-mapped filter folds into memory. Throws std::invalid_argument for modulo filters and filters of two blocks.
+    void fold() {
+        if constexpr (!std::is_same_v<typename Hash::reducer_type, ShiftReducer>) {
+            throw std::invalid_argument("Only power of two sized filters can be folded (built without --no-rounding)");
+        }
+        else {
+            const size_t num_blocks = filter.size();
+            if (num_blocks < 4 || (num_blocks & (num_blocks - 1)) != 0) {
+                throw std::invalid_argument("Filter of " + std::to_string(num_blocks) + " blocks cannot be folded (at least 4 blocks, a power of two)");
+            }
+            FilterStorage<Block> folded(num_blocks / 2, Block{});
+            for (size_t i = 0; i < folded.size(); ++i) {
+                for (size_t j = 0; j < WORDS_PER_BLOCK; ++j) {
+                    folded[i].words[j] = filter[2 * i].words[j] | filter[2 * i + 1].words[j];
+                }
+            }
+            filter = std::move(folded);
+            bits /= 2;
+            hash = Hash(filter.size());
+            count_set_bits();
+        }
+    }
+
+    std::string get_stats() const {
+        double load_factor = static_cast<double>(set_bits) / bits;
+        // The desired rate isn't saved, so is unknown once loaded
+        return (error_rate > 0 ? "\tDesired FP Rate: " + std::to_string(error_rate) + "\n" : std::string())
+               + "\tObserved FP Rate: " + std::to_string(get_fp_rate()) + "\n"
+               "\t# Hashes: " + std::to_string(num_hashes) + "\n"
+               "\t# Set Bits: " + std::to_string(set_bits) + "\n"
+               "\t# Bits: " + std::to_string(bits) + "\n"
+               "\t# Blocks: " + std::to_string(filter.size()) + "\n"
+               "\tLoad: " + std::to_string(load_factor);
+    }
+
+    void save(std::ostream& out) const {
+        out.write(reinterpret_cast<const char*>(&bits), sizeof(bits));
+        out.write(reinterpret_cast<const char*>(&set_bits), sizeof(set_bits));
+        out.write(reinterpret_cast<const char*>(&num_hashes), sizeof(num_hashes));
+
+        save_payload(out, filter);
+    }
+
+    // A mapping of the index file lets the filter be queried in place (read-only) instead of copied
+    void load(std::istream& in, uint32_t version = KEBAB_FILE_VERSION, const std::shared_ptr<const MappedFile>& mapping = nullptr) {
+        in.read(reinterpret_cast<char*>(&bits), sizeof(bits));
+        in.read(reinterpret_cast<char*>(&set_bits), sizeof(set_bits));
+
+        if (version < ALIGNED_PAYLOAD_VERSION) {
+            filter = FilterStorage<Block>(bits / BLOCK_BITS, Block{});
+            in.read(reinterpret_cast<char*>(filter.data()), filter.size() * sizeof(Block));
+            in.read(reinterpret_cast<char*>(&num_hashes), sizeof(num_hashes));
+        }
+        else {
+            in.read(reinterpret_cast<char*>(&num_hashes), sizeof(num_hashes));
+            load_payload(in, filter, bits / BLOCK_BITS, mapping);
+        }
+
+        hash = Hash(filter.size());
+    }
+
+private:
+    size_t num_elements;
+    double error_rate;
+
+    size_t bits;
+    size_t set_bits;
+    FilterStorage<Block> filter;
+
+    size_t num_hashes;
+    Hash hash;
+
+    void init(size_t elements, double error_rate, size_t num_hashes, FilterSizeMode filter_size_mode) {
+        num_elements = elements;
+        this->error_rate = error_rate;
+        validate_params();
+
+        bits = (num_hashes == 0)
+            ? optimal_bits(elements, error_rate)
+            : optimal_bits(elements, error_rate, num_hashes);
+        bits = round_bits(bits, filter_size_mode);
+
+        // Whole blocks only, and at least two so the block reducer has a bit to work with
+        size_t num_blocks = std::max<size_t>(2, (bits + BLOCK_BITS - 1) / BLOCK_BITS);
+        bits = num_blocks * BLOCK_BITS;
+
+        set_bits = 0;
+        filter = FilterStorage<Block>(num_blocks, Block{});
+
+        this->num_hashes = (num_hashes == 0) ? optimal_hashes(num_elements, bits, error_rate) : num_hashes;
+        hash = Hash(num_blocks);
+        validate_num_hashes();
+    }
+
+    void validate_params() const {
+        if (this->error_rate <= 0 || this->error_rate >= 1) {
+            throw std::invalid_argument("Desired false positive rate (" + std::to_string(this->error_rate) + ") must be between 0 and 1");
+        }
+        if (this->num_elements == 0) {
+            throw std::invalid_argument("Estimated number of elements (" + std::to_string(this->num_elements) + ") must be greater than 0");
+        }
+    }
+
+    void validate_num_hashes() const {
+        // One seed is reserved for block selection
+        if (this->num_hashes >= std::size(SEEDS)) {
+            throw std::invalid_argument("Number of hashes (" + std::to_string(this->num_hashes) + ") must be at most " + std::to_string(std::size(SEEDS) - 1) + " for blocked filters");
+        }
+    }
+
+    // Hashes per value, fixed at compile time when a caller specialises on the count (0 uses num_hashes)
+    template<size_t NumHashes>
+    size_t probe_count() const noexcept {
+        return NumHashes == 0 ? num_hashes : NumHashes;
+    }
+
+    uint64_t get_block_bit(uint64_t val, size_t i) const noexcept {
+        return hash.hash(val, SEEDS[i + 1]) >> BLOCK_BIT_SHIFT;
+    }
+
+    template<size_t NumHashes>
+    bool check_block(const Block& block, uint64_t val) const noexcept {
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
+            uint64_t bit = get_block_bit(val, i);
+            if (!(block.words[bit / BITS_PER_WORD] & get_bit_mask(bit))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static constexpr word_t get_bit_mask(uint64_t bit) noexcept {
+        return word_t{1} << (bit % BITS_PER_WORD);
+    }
+};
+
+using BlockedModFilter = BlockedBloomFilter<MultiplyMod>;
+using BlockedShiftFilter = BlockedBloomFilter<MultiplyShift>;
+
+} // namespace kebab
+
+#endif // BLOCKED_BLOOM_FILTER_H
@@ -7,11 +7,14 @@
 #include <climits>
 #include <cmath>
 #include <iostream>
+#include <stdexcept>
+#include <type_traits>
 #include <omp.h>
 
 #include "constants.hpp"
 
 #include "kebab/domain_hash.hpp"
+#include "kebab/filter_storage.hpp"
 
 #define L1_PREFETCH(address) __builtin_prefetch(address, 0, 3)
 
@@ -58,6 +61,60 @@ inline size_t calculate_num_words(size_t size) {
     return std::ceil(static_cast<double>(size) / BITS_PER_WORD);
 }
 
+// =============================================
+// Filter Sizing (shared by all filter layouts)
+// =============================================
+
+inline size_t optimal_bits(size_t elements, double error_rate, size_t num_hashes) {
+    // m = (-k * n) / ln(1-p^(1/k))
+    return static_cast<size_t>(((-1.0 * num_hashes * elements) / (std::log(1-std::pow(error_rate, 1.0/num_hashes)))));
+}
+
+inline size_t optimal_bits(size_t elements, double error_rate) {
+    // m = (-n ln(p)) / (ln(2))^2
+    return static_cast<size_t>((-1.0 *elements * std::log(error_rate)) / (std::log(2) * std::log(2)));
+}
+
+inline size_t optimal_hashes(size_t num_elements, size_t bits, double error_rate) {
+    // k = -ln(p) / ln(2)
+    double k = -std::log(error_rate) / std::log(2);
+
+    size_t k_ceil = static_cast<size_t>(std::ceil(k));
+    size_t k_floor = static_cast<size_t>(std::floor(k));
+    if (k_floor == 0) {
+        return k_ceil;
+    }
+
+    // fp = (1 - e^(-k * n / m))^k
+    auto fp = [num_elements, bits](size_t k) {
+        return std::pow(1-std::exp(-k*num_elements/bits), k);
+    };
+
+    double p_ceil = fp(k_ceil);
+    double p_floor = fp(k_floor);
+
+    return (p_ceil < p_floor) ? k_ceil : k_floor;
+}
+
+inline size_t round_bits(size_t bits, FilterSizeMode filter_size_mode) {
+    if (use_shift_filter(filter_size_mode)) {
+        uint64_t next = next_power_of_two(bits);
+        uint64_t prev = previous_power_of_two(bits);
+        // relative position between prev and next, normalized to [0, 1]
+        double relative_position = (bits - prev) / static_cast<double>(prev);
+
+        // if in lower threshold, override to round down
+        if (filter_size_mode == FilterSizeMode::NEXT_POWER_OF_TWO) {
+            bits = (relative_position <= ROUND_THRESHOLD) ? prev : next;
+        } 
+        // if in upper threshold, override to round up
+        else if (filter_size_mode == FilterSizeMode::PREVIOUS_POWER_OF_TWO) {
+            bits = (relative_position >= 1.0 - ROUND_THRESHOLD) ? next : prev;
+        }
+    }
+    return bits;
+}
+
 struct PrefetchInfo {
     std::vector<uint64_t> hash_vals;
     std::vector<const word_t*> words;
@@ -68,14 +125,17 @@ struct PrefetchInfo {
 template<typename Hash = MultiplyShift>
 class BloomFilter {
 public:
+    using PrefetchInfo = kebab::PrefetchInfo;
+
     BloomFilter() : num_elements(0), error_rate(0), bits(0), set_bits(0), filter(), num_hashes(0), hash() {}
 
     BloomFilter(size_t elements, double error_rate = DEFAULT_FP_RATE, size_t num_hashes = DEFAULT_HASH_FUNCS, FilterSizeMode filter_size_mode = DEFAULT_FILTER_SIZE_MODE) {
         init(elements, error_rate, num_hashes, filter_size_mode);
     }
 
+    template<size_t NumHashes = 0>
     void add(uint64_t val) {
-        for (size_t i = 0; i < num_hashes; ++i) {
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
             uint64_t hash_val = hash(val, SEEDS[i]);
             word_t* word = get_word(hash_val);
             word_t bit_mask = get_bit_mask(hash_val);
@@ -94,8 +154,9 @@ public:
         }
     }
 
+    template<size_t NumHashes = 0>
     bool contains(uint64_t val) const {
-        for (size_t i = 0; i < num_hashes; ++i) {
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
             uint64_t hash_val = hash(val, SEEDS[i]);
             word_t word = get_word(hash_val);
             word_t bit_mask = get_bit_mask(hash_val);
@@ -107,17 +168,19 @@ public:
         return true;
     }
 
-    void prefetch_words(uint64_t val, PrefetchInfo& info) {
+    template<size_t NumHashes = 0>
+    void prefetch_words(uint64_t val, PrefetchInfo& info) const {
         // Compute hash values, store words for later access, and issue prefetches all in one loop
-        for (size_t i = 0; i < num_hashes; ++i) {
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
             info.hash_vals[i] = hash(val, SEEDS[i]);
             info.words[i] = get_word_fetch(info.hash_vals[i]);
             L1_PREFETCH(info.words[i]);
         }
     }
 
+    template<size_t NumHashes = 0>
     bool check_prefetch(const PrefetchInfo& info) const {
-        for (size_t i = 0; i < num_hashes; ++i) {
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
             word_t bit_mask = get_bit_mask(info.hash_vals[i]);
             if (!(*info.words[i] & bit_mask)) {
                 return false;
@@ -126,14 +189,92 @@ public:
         return true;
     }
 
+    // Calls visit(bit) for each filter bit val sets, for callers that partition insertions instead of calling add
+    template<size_t NumHashes = 0, typename Visitor>
+    void for_each_bit(uint64_t val, Visitor visit) const {
+        for (size_t i = 0; i < probe_count<NumHashes>(); ++i) {
+            visit(hash(val, SEEDS[i]));
+        }
+    }
+
+    // Not synchronised: the caller must be the only thread writing the bit's word. Leaves set_bits stale until count_set_bits.
+    void set_bit(uint64_t bit) noexcept {
+        *get_word(bit) |= get_bit_mask(bit);
+    }
+
+    // A single memory bound pass, cheap next to building the filter
+    void count_set_bits() {
+        size_t count = 0;
+        const word_t* words = filter.data();
+        for (size_t i = 0; i < filter.size(); ++i) {
+            count += __builtin_popcountll(words[i]);
+        }
+        set_bits = count;
+    }
+
+    size_t get_bits() const {
+        return bits;
+    }
+
     size_t get_num_hashes() const {
         return num_hashes;
     }
 
+    // Each hash probes an independent word, so a lookup may touch num_hashes cache lines
+    size_t get_lines_per_lookup() const {
+        return num_hashes;
+    }
+
+    // Chance an absent value is reported present, from the fraction of bits set
+    double get_fp_rate() const {
+        return std::pow(static_cast<double>(set_bits) / bits, num_hashes);
+    }
+
+    // ORs in a filter of the same size and hash count, which then holds the values of both.
+    // Throws std::invalid_argument if they differ, the filter must not be memory-mapped.
+    void merge(const BloomFilter& other) {
+        if (bits != other.bits || num_hashes != other.num_hashes) {
+            throw std::invalid_argument("Filters differ in size or hash count (" + std::to_string(bits) + " bits, " + std::to_string(num_hashes) + " hashes vs "
+                                        + std::to_string(other.bits) + " bits, " + std::to_string(other.num_hashes) + " hashes)");
+        }
+        if (filter.is_mapped()) {
+            throw std::runtime_error("Cannot merge into a memory-mapped filter");
+        }
+        word_t* words = filter.data();
+        const word_t* other_words = other.filter.data();
+        for (size_t i = 0; i < filter.size(); ++i) {
+            words[i] |= other_words[i];
+        }
+        count_set_bits();
+    }
+
+    // Halves the filter, which still holds every value but at a higher false positive rate. A shift filter's bit is the
+    // top bits of a hash, so with one bit fewer bits 2i and 2i + 1 become bit i. A memory-mapped filter folds into memory.
+    // Throws std::invalid_argument for modulo filters, which have no such pairs, and filters of a single word.
+    void fold() {
+        if constexpr (!std::is_same_v<typename Hash::reducer_type, ShiftReducer>) {
+            throw std::invalid_argument("Only power of two sized filters can be folded (built without --no-rounding)");
+        }
+        else {
+            if (bits < 2 * BITS_PER_WORD || (bits & (bits - 1)) != 0) {
+                throw std::invalid_argument("Filter of " + std::to_string(bits) + " bits cannot be folded (at least " + std::to_string(2 * BITS_PER_WORD) + " bits, a power of two)");
+            }
+            FilterStorage<word_t> folded(filter.size() / 2, word_t{});
+            for (size_t i = 0; i < folded.size(); ++i) {
+                folded[i] = fold_word(filter[2 * i]) | (fold_word(filter[2 * i + 1]) << (BITS_PER_WORD / 2));
+            }
+            filter = std::move(folded);
+            bits /= 2;
+            hash = Hash(bits);
+            count_set_bits();
+        }
+    }
+
     std::string get_stats() const {
         double load_factor = static_cast<double>(set_bits) / bits;
-        return "\tDesired FP Rate: " + std::to_string(error_rate) + "\n"
-               "\tObserved FP Rate: " + std::to_string(std::pow(load_factor, num_hashes)) + "\n"
+        // The desired rate isn't saved, so is unknown once loaded
+        return (error_rate > 0 ? "\tDesired FP Rate: " + std::to_string(error_rate) + "\n" : std::string())
+               + "\tObserved FP Rate: " + std::to_string(get_fp_rate()) + "\n"
                "\t# Hashes: " + std::to_string(num_hashes) + "\n"
                "\t# Set Bits: " + std::to_string(set_bits) + "\n"
                "\t# Bits: " + std::to_string(bits) + "\n"
@@ -143,20 +284,26 @@ public:
     void save(std::ostream& out) const {
         out.write(reinterpret_cast<const char*>(&bits), sizeof(bits));
         out.write(reinterpret_cast<const char*>(&set_bits), sizeof(set_bits));
-
-        out.write(reinterpret_cast<const char*>(filter.data()), filter.size() * sizeof(word_t));
-
         out.write(reinterpret_cast<const char*>(&num_hashes), sizeof(num_hashes));
+
+        save_payload(out, filter);
     }
 
-    void load(std::istream& in) {
+    // A mapping of the index file lets the filter be queried in place (read-only) instead of copied
+    void load(std::istream& in, uint32_t version = KEBAB_FILE_VERSION, const std::shared_ptr<const MappedFile>& mapping = nullptr) {
         in.read(reinterpret_cast<char*>(&bits), sizeof(bits));
         in.read(reinterpret_cast<char*>(&set_bits), sizeof(set_bits));
 
-        filter = std::vector<word_t>(calculate_num_words(bits), 0ULL);
-        in.read(reinterpret_cast<char*>(filter.data()), filter.size() * sizeof(word_t));
+        if (version < ALIGNED_PAYLOAD_VERSION) {
+            filter = FilterStorage<word_t>(calculate_num_words(bits), word_t{});
+            in.read(reinterpret_cast<char*>(filter.data()), filter.size() * sizeof(word_t));
+            in.read(reinterpret_cast<char*>(&num_hashes), sizeof(num_hashes));
+        }
+        else {
+            in.read(reinterpret_cast<char*>(&num_hashes), sizeof(num_hashes));
+            load_payload(in, filter, calculate_num_words(bits), mapping);
+        }
 
-        in.read(reinterpret_cast<char*>(&num_hashes), sizeof(num_hashes));
         hash = Hash(bits);
     }
 
@@ -166,7 +313,7 @@ private:
     
     size_t bits;
     size_t set_bits;
-    std::vector<word_t> filter;
+    FilterStorage<word_t> filter;
 
     size_t num_hashes;
     Hash hash;
@@ -179,62 +326,16 @@ private:
         bits = (num_hashes == 0) 
             ? optimal_bits(elements, error_rate) 
             : optimal_bits(elements, error_rate, num_hashes);
-
-        if (use_shift_filter(filter_size_mode)) {
-            uint64_t next = next_power_of_two(bits);
-            uint64_t prev = previous_power_of_two(bits);
-            // relative position between prev and next, normalized to [0, 1]
-            double relative_position = (bits - prev) / static_cast<double>(prev);
-
-            // if in lower threshold, override to round down
-            if (filter_size_mode == FilterSizeMode::NEXT_POWER_OF_TWO) {
-                bits = (relative_position <= ROUND_THRESHOLD) ? prev : next;
-            } 
-            // if in upper threshold, override to round up
-            else if (filter_size_mode == FilterSizeMode::PREVIOUS_POWER_OF_TWO) {
-                bits = (relative_position >= 1.0 - ROUND_THRESHOLD) ? next : prev;
-            }
-        }
+        bits = round_bits(bits, filter_size_mode);
 
         set_bits = 0;
-        filter = std::vector<word_t>(calculate_num_words(bits), 0ULL);
+        filter = FilterStorage<word_t>(calculate_num_words(bits), 0ULL);
 
-        this->num_hashes = (num_hashes == 0) ? optimal_hashes(error_rate) : num_hashes;
+        this->num_hashes = (num_hashes == 0) ? optimal_hashes(num_elements, bits, error_rate) : num_hashes;
         hash = Hash(bits);
         validate_num_hashes();
     }
 
-    size_t optimal_hashes(double error_rate) const {
-        // k = -ln(p) / ln(2)
-        double k = -std::log(error_rate) / std::log(2);
-
-        size_t k_ceil = static_cast<size_t>(std::ceil(k));
-        size_t k_floor = static_cast<size_t>(std::floor(k));
-        if (k_floor == 0) {
-            return k_ceil;
-        }
-
-        // fp = (1 - e^(-k * n / m))^k
-        auto fp = [this](size_t k) {
-            return std::pow(1-std::exp(-k*num_elements/bits), k);
-        };
-
-        double p_ceil = fp(k_ceil);
-        double p_floor = fp(k_floor);
-
-        return (p_ceil < p_floor) ? k_ceil : k_floor;
-    }
-
-    static size_t optimal_bits(size_t elements, double error_rate, size_t num_hashes) {
-        // m = (-k * n) / ln(1-p^(1/k))
-        return static_cast<size_t>(((-1.0 * num_hashes * elements) / (std::log(1-std::pow(error_rate, 1.0/num_hashes)))));
-    }
-
-    static size_t optimal_bits(size_t elements, double error_rate) {
-        // m = (-n ln(p)) / (ln(2))^2
-        return static_cast<size_t>((-1.0 *elements * std::log(error_rate)) / (std::log(2) * std::log(2)));
-    } 
-
     void validate_params() const {
         if (this->error_rate <= 0 || this->error_rate >= 1) {
             throw std::invalid_argument("Desired false positive rate (" + std::to_string(this->error_rate) + ") must be between 0 and 1");
@@ -250,6 +351,12 @@ private:
         }
     }
 
+    // Hashes per value, fixed at compile time when a caller specialises on the count (0 uses num_hashes)
+    template<size_t NumHashes>
+    size_t probe_count() const noexcept {
+        return NumHashes == 0 ? num_hashes : NumHashes;
+    }
+
     word_t* get_word(uint64_t hash_val) noexcept {
         return &filter[hash_val / BITS_PER_WORD];
     }
@@ -265,6 +372,17 @@ private:
     static constexpr word_t get_bit_mask(uint64_t hash_val) noexcept {
         return word_t{1} << (hash_val % BITS_PER_WORD);
     }
+
+    // ORs each pair of adjacent bits into one, packing the 32 results into the low half
+    static constexpr word_t fold_word(word_t word) noexcept {
+        word = (word | (word >> 1)) & 0x5555555555555555ULL;
+        word = (word | (word >> 1)) & 0x3333333333333333ULL;
+        word = (word | (word >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+        word = (word | (word >> 4)) & 0x00FF00FF00FF00FFULL;
+        word = (word | (word >> 8)) & 0x0000FFFF0000FFFFULL;
+        word = (word | (word >> 16)) & 0x00000000FFFFFFFFULL;
+        return word;
+    }
 };
 
 using ModFilter = BloomFilter<MultiplyMod>;
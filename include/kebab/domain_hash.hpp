@@ -94,6 +94,8 @@ private:
 template<typename Hash=MultiplyHash, typename Reducer=ShiftReducer>
 class DomainHashFunction {
 public:
+    using reducer_type = Reducer;
+
     DomainHashFunction()
         : hash_(Hash())
         , reducer_(Reducer(0)) {}
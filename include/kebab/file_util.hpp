@@ -0,0 +1,21 @@
+#ifndef KEBAB_FILE_UTIL_HPP
+#define KEBAB_FILE_UTIL_HPP
+
+#include <string>
+#include <ostream>
+#include <functional>
+#include <cstdint>
+
+namespace kebab {
+
+// Size and modification time identifying a file's contents, false if it can't be inspected
+bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime);
+
+// Writes path through write to a temporary file beside it, renamed into place once complete. Readers see the old
+// file or a whole new one, and concurrent writers of the same path never share a temporary file.
+// Throws std::runtime_error naming what was being written if writing or renaming fails, leaving nothing behind.
+void write_file_atomically(const std::string& path, const std::string& what, const std::function<void(std::ostream&)>& write);
+
+} // namespace kebab
+
+#endif // KEBAB_FILE_UTIL_HPP
@@ -0,0 +1,105 @@
+#ifndef KEBAB_FILTER_STORAGE_HPP
+#define KEBAB_FILTER_STORAGE_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "constants.hpp"
+
+#include "kebab/mapped_file.hpp"
+
+namespace kebab {
+
+// Bit array backing a filter, either owned on the heap or viewed in place inside a mapped index file.
+// Mapped storage is read-only: it can be queried but not added to.
+template<typename T>
+class FilterStorage {
+public:
+    FilterStorage() : owned(), mapping(), base(nullptr), count(0) {}
+
+    FilterStorage(size_t count, const T& value) : owned(count, value), mapping(), base(owned.data()), count(count) {}
+
+    FilterStorage(std::shared_ptr<const MappedFile> file, size_t offset, size_t count)
+        : owned()
+        , mapping(std::move(file))
+        , base(reinterpret_cast<T*>(const_cast<char*>(mapping->data() + offset)))
+        , count(count) {}
+
+    FilterStorage(const FilterStorage& other)
+        : owned(other.owned), mapping(other.mapping), base(other.mapping ? other.base : owned.data()), count(other.count) {}
+
+    FilterStorage(FilterStorage&& other) noexcept
+        : owned(std::move(other.owned)), mapping(std::move(other.mapping)), base(mapping ? other.base : owned.data()), count(other.count) {}
+
+    FilterStorage& operator=(const FilterStorage& other) {
+        owned = other.owned;
+        mapping = other.mapping;
+        base = mapping ? other.base : owned.data();
+        count = other.count;
+        return *this;
+    }
+
+    FilterStorage& operator=(FilterStorage&& other) noexcept {
+        owned = std::move(other.owned);
+        mapping = std::move(other.mapping);
+        base = mapping ? other.base : owned.data();
+        count = other.count;
+        return *this;
+    }
+
+    T& operator[](size_t i) noexcept { return base[i]; }
+    const T& operator[](size_t i) const noexcept { return base[i]; }
+
+    T* data() noexcept { return base; }
+    const T* data() const noexcept { return base; }
+    size_t size() const noexcept { return count; }
+    bool is_mapped() const noexcept { return static_cast<bool>(mapping); }
+
+private:
+    std::vector<T> owned;
+    std::shared_ptr<const MappedFile> mapping;
+    T* base;
+    size_t count;
+};
+
+// Payloads start on a page boundary of the index file so they can be used in place when mapped
+inline size_t aligned_payload_offset(size_t pos) {
+    return (pos + FILTER_PAYLOAD_ALIGNMENT - 1) / FILTER_PAYLOAD_ALIGNMENT * FILTER_PAYLOAD_ALIGNMENT;
+}
+
+template<typename T>
+void save_payload(std::ostream& out, const FilterStorage<T>& storage) {
+    size_t pos = static_cast<size_t>(out.tellp());
+    static const char zeros[FILTER_PAYLOAD_ALIGNMENT] = {};
+    out.write(zeros, aligned_payload_offset(pos) - pos);
+
+    out.write(reinterpret_cast<const char*>(storage.data()), storage.size() * sizeof(T));
+}
+
+// Maps the payload if a mapping of the same file is given, otherwise reads it into memory
+template<typename T>
+void load_payload(std::istream& in, FilterStorage<T>& storage, size_t count, const std::shared_ptr<const MappedFile>& mapping) {
+    size_t offset = aligned_payload_offset(static_cast<size_t>(in.tellg()));
+    size_t bytes = count * sizeof(T);
+
+    if (mapping) {
+        if (offset + bytes > mapping->size()) {
+            throw std::runtime_error("Index file is truncated (expected " + std::to_string(offset + bytes) + " bytes, found " + std::to_string(mapping->size()) + ")");
+        }
+        storage = FilterStorage<T>(mapping, offset, count);
+        in.seekg(offset + bytes);
+    }
+    else {
+        in.seekg(offset);
+        storage = FilterStorage<T>(count, T{});
+        in.read(reinterpret_cast<char*>(storage.data()), bytes);
+    }
+}
+
+} // namespace kebab
+
+#endif // KEBAB_FILTER_STORAGE_HPP
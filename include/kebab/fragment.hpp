@@ -0,0 +1,116 @@
+#ifndef KEBAB_FRAGMENT_HPP
+#define KEBAB_FRAGMENT_HPP
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+namespace kebab {
+
+// A sequence to scan, not owned
+struct Sequence {
+    const char* seq;
+    size_t len;
+};
+
+// Range of a scanned sequence that may overlap a MEM, 0-based
+struct Fragment {
+    size_t start;
+    size_t length;
+
+    // Longest first, ties in sequence order, so a full sort and a top-t selection agree
+    bool operator<(const Fragment& other) const {
+        return length > other.length || (length == other.length && start < other.start); // > for descending order
+    }
+};
+
+// Replaces out with the fragments a scan with a larger min_mem_length would find, given those of a scan of the same
+// sequence with a smaller minimum and no overlap removal. Filter misses don't depend on the minimum, so one scan serves
+// every threshold: a fragment ends at each miss either way, and only the shorter ones are dropped.
+inline void select_fragments(const Fragment* candidates, size_t count, uint64_t min_mem_length, bool remove_overlaps, std::vector<Fragment>& out) {
+    out.clear();
+    size_t last_frag_end = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const Fragment& fragment = candidates[i];
+        if (fragment.length < min_mem_length) {
+            continue;
+        }
+        const size_t frag_end = fragment.start + fragment.length;
+        if (remove_overlaps && !out.empty() && fragment.start < last_frag_end) {
+            out.back().length += frag_end - last_frag_end;
+        }
+        else {
+            out.push_back(fragment);
+        }
+        last_frag_end = frag_end;
+    }
+}
+
+// Scan of one chunk of a sequence, every chunk after the first starting k - 1 bases before the previous one ends
+struct ChunkFragments {
+    size_t offset = 0;     // of the chunk in the sequence
+    size_t len = 0;
+    size_t head_end = 0;   // first run of present k-mers covers [0, head_end) of the chunk
+    size_t tail_start = 0; // last run covers [tail_start, len)
+    std::vector<Fragment> fragments; // in chunk order, without overlap removal or top-t selection
+};
+
+// Replaces out with the fragments a scan of the whole sequence would find (before overlap removal or top-t selection)
+// from those of its consecutive chunks. Each k-mer is in exactly one chunk, so only the runs cut by a chunk's ends
+// change: a chunk's last run continues into the next chunk's first, through any chunk that is a single run.
+inline void stitch_fragments(const std::vector<ChunkFragments>& chunks, uint64_t min_mem_length, std::vector<Fragment>& out) {
+    out.clear();
+    size_t run_start = 0; // of the run open across the last chunk boundary
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        const ChunkFragments& chunk = chunks[c];
+        const bool first = c == 0;
+        const bool last = c + 1 == chunks.size();
+        const bool single_run = chunk.head_end == chunk.len;
+
+        // Only the first run starts at 0 and only the last ends at len, both are cut short unless at the sequence's ends
+        const Fragment* begin = chunk.fragments.data();
+        const Fragment* end = begin + chunk.fragments.size();
+        if (!first && begin != end && begin->start == 0) {
+            ++begin;
+        }
+        if (!last && begin != end && (end - 1)->start + (end - 1)->length == chunk.len) {
+            --end;
+        }
+
+        if (!first && (!single_run || last)) {
+            const size_t run_end = chunk.offset + chunk.head_end;
+            if (run_end - run_start >= min_mem_length) {
+                out.push_back({run_start, run_end - run_start});
+            }
+        }
+        for (const Fragment* fragment = begin; fragment != end; ++fragment) {
+            out.push_back({chunk.offset + fragment->start, fragment->length});
+        }
+        if (!last && (first || !single_run)) {
+            run_start = chunk.offset + chunk.tail_start;
+        }
+    }
+}
+
+// Keeps the top_t longest fragments seen in top as a heap with the shortest in front, so a fragment that
+// can't make the cut costs one comparison. finish_top_fragments puts them in sorted order.
+inline void add_top_fragment(std::vector<Fragment>& top, const Fragment& fragment, size_t top_t) {
+    if (top.size() < top_t) {
+        top.push_back(fragment);
+        std::push_heap(top.begin(), top.end());
+    }
+    else if (fragment < top.front()) {
+        std::pop_heap(top.begin(), top.end());
+        top.back() = fragment;
+        std::push_heap(top.begin(), top.end());
+    }
+}
+
+inline void finish_top_fragments(std::vector<Fragment>& top) {
+    std::sort_heap(top.begin(), top.end());
+}
+
+} // namespace kebab
+
+#endif // KEBAB_FRAGMENT_HPP
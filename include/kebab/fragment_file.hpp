@@ -0,0 +1,101 @@
+#ifndef KEBAB_FRAGMENT_FILE_HPP
+#define KEBAB_FRAGMENT_FILE_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include "constants.hpp"
+
+#include "kebab/fragment.hpp"
+
+// Binary fragment files (.kbf) keep the ranges of each scanned read's fragments instead of FASTA records.
+//
+// The header is the magic, version and flags (u32 each). Blocks follow, one per input batch in any order:
+// batch id, id of the batch's first read and payload size (u64 each), then the payload. Batch ids count up from 0
+// and every batch has a block, so readers can restore input order. A payload has a record per read with fragments,
+// made of LEB128 varints: read id less the batch's first, name length, name, mate (0 unpaired, otherwise 1 or 2),
+// fragment count, then the start and length of each fragment. With FRAGMENT_FILE_PACKED, each fragment's bases
+// follow the record, 2 bits per base (A, C, T, G as 0 to 3, first base lowest) padded to a whole byte.
+// Fragments never contain ambiguous bases, so packing only loses soft-masking (bases decode in upper case).
+
+namespace kebab {
+
+static constexpr uint32_t FRAGMENT_FILE_PACKED = 1;
+
+// Throws std::runtime_error if the header cannot be written
+void write_fragment_file_header(FILE* out, bool packed);
+
+// Encodes one batch's block into a caller-owned buffer
+class FragmentBlockWriter {
+public:
+    FragmentBlockWriter(std::string& out, uint64_t batch_id, uint64_t first_read_id, bool packed);
+
+    // read_index is the read's position in the batch, seq its bases (only read when packing)
+    void add(size_t read_index, const char* name, size_t name_len, uint8_t mate, const char* seq, const Fragment* fragments, size_t count);
+    // Completes the block, the buffer holds it whole afterwards
+    void finish();
+
+private:
+    std::string& out;
+    size_t block_start;
+    bool packed;
+};
+
+// One read's fragments from a fragment file
+struct FragmentRecord {
+    uint64_t read_id = 0; // position of the read in the scanned input, mates counted separately
+    std::string name;
+    uint8_t mate = 0;
+    std::vector<Fragment> fragments;
+
+    // Replaces seq with the bases of fragment i, requires a file with packed sequences
+    void get_sequence(size_t i, std::string& seq) const;
+
+private:
+    friend class FragmentReader;
+
+    std::vector<uint8_t> packed;
+    std::vector<size_t> packed_offsets; // of each fragment's bases in packed
+};
+
+// Reads records back in input order, whatever order the blocks were written in.
+// Throws std::runtime_error if the file cannot be opened or is malformed.
+class FragmentReader {
+public:
+    explicit FragmentReader(const std::string& path);
+    ~FragmentReader();
+
+    FragmentReader(const FragmentReader&) = delete;
+    FragmentReader& operator=(const FragmentReader&) = delete;
+
+    bool has_sequences() const noexcept { return packed; }
+
+    // False once every record has been read
+    bool next(FragmentRecord& record);
+
+private:
+    struct Block {
+        uint64_t first_read_id = 0;
+        std::vector<uint8_t> payload;
+    };
+
+    FILE* in;
+    std::string path;
+    bool packed;
+
+    uint64_t next_batch;
+    std::map<uint64_t, Block> pending; // blocks read ahead of their turn
+    Block current;
+    size_t pos; // in current's payload
+
+    bool read_block(uint64_t& batch_id, Block& block);
+    bool next_block();
+};
+
+} // namespace kebab
+
+#endif // KEBAB_FRAGMENT_FILE_HPP
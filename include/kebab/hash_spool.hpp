@@ -0,0 +1,60 @@
+#ifndef KEBAB_HASH_SPOOL_HPP
+#define KEBAB_HASH_SPOOL_HPP
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+namespace kebab {
+
+// K-mer hashes kept from a build's estimation pass, so they can be inserted once the filter is sized
+// without reading and hashing the input again. Chunks stay in memory up to a budget, later ones spill to a
+// temporary file (unlinked on creation, so it never outlives the process).
+class HashSpool {
+public:
+    HashSpool(size_t memory_budget, const std::string& spill_path);
+    ~HashSpool();
+
+    HashSpool(const HashSpool&) = delete;
+    HashSpool& operator=(const HashSpool&) = delete;
+
+    // Thread-safe, takes ownership of the chunk's hashes. A failed spill drops the chunk and sets an error (see get_error).
+    void add(std::vector<uint64_t>&& hashes);
+
+    bool failed() const noexcept { return !error.empty(); }
+    const std::string& get_error() const noexcept { return error; }
+
+    size_t get_num_chunks() const noexcept { return chunks.size(); }
+    uint64_t get_num_hashes() const noexcept { return num_hashes; }
+    uint64_t get_spilled_bytes() const noexcept { return spilled_bytes; }
+
+    // Hashes of chunk i, read into buffer if it was spilled. Safe to call concurrently once adding is done,
+    // throws std::runtime_error if the spill file cannot be read.
+    const uint64_t* get_chunk(size_t i, std::vector<uint64_t>& buffer, size_t& count) const;
+
+private:
+    struct Chunk {
+        std::vector<uint64_t> hashes; // empty if spilled
+        uint64_t offset;              // in the spill file
+        size_t count;
+    };
+
+    size_t memory_budget;
+    size_t memory_used;
+    std::string spill_path;
+    int spill_fd;
+    uint64_t spilled_bytes;
+    uint64_t num_hashes;
+    std::string error;
+
+    std::vector<Chunk> chunks;
+    std::mutex mutex;
+
+    void spill(Chunk& chunk, const std::vector<uint64_t>& hashes);
+};
+
+} // namespace kebab
+
+#endif // KEBAB_HASH_SPOOL_HPP
@@ -0,0 +1,47 @@
+#ifndef KEBAB_INDEX_FILE_HPP
+#define KEBAB_INDEX_FILE_HPP
+
+#include <iostream>
+#include <cstdint>
+
+#include "constants.hpp"
+
+#include "kebab/kebab_index.hpp"
+
+namespace kebab {
+
+// Stored ahead of the index itself, decides which filter type it is loaded as
+struct IndexHeader {
+    uint32_t version = KEBAB_FILE_VERSION;
+    FilterSizeMode filter_size_mode = DEFAULT_FILTER_SIZE_MODE;
+    FilterType filter_type = DEFAULT_FILTER_TYPE;
+};
+
+void write_index_header(std::ostream& out, FilterSizeMode filter_size_mode, FilterType filter_type);
+
+// Accepts legacy indexes without a header, throws std::runtime_error for indexes from a newer version
+IndexHeader read_index_header(std::istream& in);
+
+template<typename T>
+struct IndexTag {
+    using type = T;
+};
+
+// Calls visit(IndexTag<KebabIndex<Filter>>()) with the filter an index of this layout uses
+template<typename Visitor>
+decltype(auto) visit_index_type(FilterType filter_type, FilterSizeMode filter_size_mode, Visitor&& visit) {
+    if (filter_type == FilterType::BLOCKED) {
+        if (use_shift_filter(filter_size_mode)) {
+            return visit(IndexTag<KebabIndex<BlockedShiftFilter>>());
+        }
+        return visit(IndexTag<KebabIndex<BlockedModFilter>>());
+    }
+    if (use_shift_filter(filter_size_mode)) {
+        return visit(IndexTag<KebabIndex<ShiftFilter>>());
+    }
+    return visit(IndexTag<KebabIndex<ModFilter>>());
+}
+
+} // namespace kebab
+
+#endif // KEBAB_INDEX_FILE_HPP
@@ -0,0 +1,95 @@
+#ifndef KEBAB_INPUT_STREAM_HPP
+#define KEBAB_INPUT_STREAM_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace kebab {
+
+enum class Compression {
+    NONE,
+    GZIP,   // Any gzip stream, possibly several concatenated members
+    BGZF    // Blocked gzip (bgzip), whose independent blocks can be inflated in parallel
+};
+
+const char* compression_name(Compression compression) noexcept;
+
+// Sequence file input, transparently decompressing gzip. BGZF files are split on block boundaries and
+// inflated by a pool of threads, other gzip files by a single thread running ahead of the parser.
+// Decompressed data is always delivered in file order.
+class InputStream {
+public:
+    // Throws std::runtime_error if the file cannot be opened
+    InputStream(const std::string& path, uint16_t threads);
+    ~InputStream();
+
+    InputStream(const InputStream&) = delete;
+    InputStream& operator=(const InputStream&) = delete;
+
+    // Copies up to len bytes of (decompressed) input into buf, kseq compatible:
+    // returns the number of bytes copied, 0 at end of input, or -1 on error (see get_error)
+    int read(void* buf, int len);
+
+    Compression get_compression() const noexcept { return compression; }
+    size_t get_file_size() const noexcept { return file_size; }
+    // Bytes of the file consumed so far, compressed if the input is, for progress reporting
+    size_t get_bytes_consumed() const noexcept { return bytes_consumed.load(std::memory_order_relaxed); }
+
+    bool failed() const noexcept { return !error.empty(); }
+    const std::string& get_error() const noexcept { return error; }
+
+private:
+    enum class ChunkState { FREE, COMPRESSED, READY };
+
+    // Decompressed input with a fixed position in the stream, chunk id lives in slot id % chunks.size()
+    struct Chunk {
+        ChunkState state = ChunkState::FREE;
+        size_t id = 0;
+        std::vector<unsigned char> compressed; // whole BGZF blocks
+        std::vector<char> data;
+        std::string error;
+    };
+
+    std::string path;
+    int fd;
+    Compression compression;
+    size_t file_size;
+    std::atomic<size_t> bytes_consumed;
+    std::string error;
+
+    std::vector<Chunk> chunks;
+    std::deque<size_t> compressed_chunks; // slots waiting for a BGZF worker
+    size_t num_chunks;                    // chunks produced so far
+    size_t next_chunk;                    // next chunk to be read
+    size_t chunk_pos;                     // read position within the next chunk
+    bool input_done;                      // num_chunks is final
+    bool stopping;
+
+    std::mutex mutex;
+    std::condition_variable chunk_freed;
+    std::condition_variable chunk_compressed;
+    std::condition_variable chunk_ready;
+    std::thread producer;
+    std::vector<std::thread> workers;
+
+    int read_plain(void* buf, int len);
+
+    Chunk* acquire_chunk(size_t id);
+    void publish_chunk(Chunk& chunk, ChunkState state);
+    void finish_input(size_t total_chunks);
+
+    void inflate_gzip();
+    void read_bgzf_blocks();
+    void inflate_bgzf_blocks();
+};
+
+} // namespace kebab
+
+#endif // KEBAB_INPUT_STREAM_HPP
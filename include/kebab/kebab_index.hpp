@@ -3,6 +3,9 @@
 
 #include "kebab/nt_hash.hpp"
 #include "kebab/bloom_filter.hpp"
+#include "kebab/blocked_bloom_filter.hpp"
+#include "kebab/mapped_file.hpp"
+#include "kebab/fragment.hpp"
 
 #include "external/kseq.h"
 
@@ -11,33 +14,122 @@
 #include <string>
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <mutex>
+#include <array>
+#include <utility>
 #include <cstdint>
 
 namespace kebab {
 
-struct Fragment {
-    size_t start;
-    size_t length;
-
-    bool operator<(const Fragment& other) const {
-        return length > other.length; // > for descending order
-    }
-};
-
 template<typename Filter = ShiftFilter>
 class KebabIndex {
+private:
+    struct PendingKmer {
+        typename Filter::PrefetchInfo prefetch_info;
+        size_t pos;
+        // Batch scans only: the read pos is in, and whether this marks a run of ambiguous k-mers pos through last
+        size_t read;
+        size_t last;
+        bool ambiguous;
+
+        PendingKmer(size_t num_hashes) : prefetch_info(num_hashes), pos(0), read(0), last(0), ambiguous(false) {}
+    };
+
 public:
+    // Scratch for scanning reads on one thread: the prefetch ring and the fragments found.
+    // Reusing a context across reads means scanning allocates nothing once its storage has grown to fit.
+    class ScanContext {
+    public:
+        std::vector<Fragment>& get_fragments() noexcept { return fragments; }
+        const std::vector<Fragment>& get_fragments() const noexcept { return fragments; }
+
+        // Fragments of read i of the last batch are batch_fragments[batch_offsets[i]] up to batch_fragments[batch_offsets[i + 1]]
+        std::vector<Fragment>& get_batch_fragments() noexcept { return batch_fragments; }
+        const std::vector<Fragment>& get_batch_fragments() const noexcept { return batch_fragments; }
+        const std::vector<size_t>& get_batch_offsets() const noexcept { return batch_offsets; }
+
+        // Of the last scanned read or batch, k-mers with ambiguous bases are never queried
+        uint64_t get_kmers_queried() const noexcept { return kmers_queried; }
+        uint64_t get_kmer_misses() const noexcept { return kmer_misses; }
+
+        // The last scanned read's first run of present k-mers covers bases [0, head_end) and its last [tail_start, len),
+        // whether or not they make fragments, so a sequence scanned in chunks can have runs joined across them
+        // (see stitch_fragments). Not set by scans skipping ahead or by batches.
+        size_t get_head_end() const noexcept { return head_end; }
+        size_t get_tail_start() const noexcept { return tail_start; }
+
+    private:
+        friend class KebabIndex;
+
+        std::vector<PendingKmer> pending_kmers;
+        size_t num_hashes = 0; // hashes per k-mer the ring was sized for
+        std::vector<Fragment> fragments;
+        std::vector<uint64_t> hashes; // k-mers around a hit when skipping ahead
+        std::vector<Fragment> batch_fragments;
+        std::vector<size_t> batch_offsets;
+        uint64_t kmers_queried = 0;
+        uint64_t kmer_misses = 0;
+        size_t head_end = 0;
+        size_t tail_start = 0;
+    };
+
+    // Insertion buffers for one thread of a parallel build. Filter bits are radix-partitioned into BUILD_PARTITIONS regions,
+    // and a full buffer is applied to its region under that region's lock, so threads share no filter words or counters.
+    class BuildContext {
+    public:
+        // Added through this context so far, k-mers of both strands count twice
+        uint64_t get_kmers_added() const noexcept { return kmers_added; }
+
+    private:
+        friend class KebabIndex;
+
+        uint64_t kmers_added = 0;
+
+        std::vector<uint64_t> bits;  // BUILD_PARTITION_BUFFER bits per partition
+        std::vector<uint32_t> counts; // bits buffered per partition
+    };
+
     KebabIndex(size_t k, size_t expected_kmers, double fp_rate, size_t num_hashes = DEFAULT_HASH_FUNCS, KmerMode kmer_mode = DEFAULT_KMER_MODE, FilterSizeMode filter_size_mode = DEFAULT_FILTER_SIZE_MODE);
-    explicit KebabIndex(std::istream& in);
+    explicit KebabIndex(std::istream& in, uint32_t version = KEBAB_FILE_VERSION, const std::shared_ptr<const MappedFile>& mapping = nullptr);
 
     size_t get_k() const { return k; }
+    KmerMode get_kmer_mode() const { return kmer_mode; }
+
+    // Filter cache lines a prefetching scan keeps in flight, at least one k-mer's worth is always used
+    size_t get_prefetch_distance() const { return prefetch_distance; }
+    void set_prefetch_distance(size_t distance) { prefetch_distance = distance; }
 
+    // Inserts directly, safe to call concurrently but every probe is an atomic update
     void add_sequence(const char* seq, size_t len);
-    std::vector<Fragment> scan_read(const char* seq, size_t len, uint64_t min_mem_length, bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS, bool prefetch = DEFAULT_PREFETCH);
+    // Buffers the k-mers of seq in the calling thread's context, the filter is only complete after finish_build
+    void add_sequence(const char* seq, size_t len, BuildContext& context);
+    // Same for k-mer hashes computed elsewhere, as NtHash with this index's k and k-mer mode produces them
+    void add_hashes(const uint64_t* hashes, size_t count, BuildContext& context);
+    // Applies every context's remaining bits and counts the filter's set bits, once all threads are done adding
+    void finish_build(std::vector<BuildContext>& contexts);
+    // Replaces the context's fragments with those of seq. A nonzero top_t keeps only the top_t longest, longest first,
+    // selected as the scan finds them; overlaps can't be merged then, as merging changes fragments already kept.
+    // Skipping ahead finds the same fragments while querying only the k-mers that can change them (see scan_read_skip).
+    void scan_read(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS, bool prefetch = DEFAULT_PREFETCH, size_t top_t = DEFAULT_TOP_T, bool skip_ahead = DEFAULT_SKIP_AHEAD) const;
+    std::vector<Fragment> scan_read(const char* seq, size_t len, uint64_t min_mem_length, bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS, bool prefetch = DEFAULT_PREFETCH, size_t top_t = DEFAULT_TOP_T, bool skip_ahead = DEFAULT_SKIP_AHEAD) const;
+    // Replaces the context's batch fragments with those of count reads, the same as scanning each read on its own.
+    // Prefetching keeps one ring of lookups in flight across read boundaries instead of filling and draining it per read,
+    // which matters for short reads, where the ring would otherwise run part empty for much of every read.
+    void scan_batch(const Sequence* reads, size_t count, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS, bool prefetch = DEFAULT_PREFETCH, size_t top_t = DEFAULT_TOP_T, bool skip_ahead = DEFAULT_SKIP_AHEAD) const;
+    // ORs in an index of the same k, k-mer mode and filter size, which then finds the k-mers of both.
+    // Throws std::invalid_argument if they differ, this index must not be memory-mapped.
+    void merge(const KebabIndex& other);
+    // Halves a power of two sized filter, trading false positive rate for a filter that may fit in cache.
+    // Throws std::invalid_argument if it can't be folded, a memory-mapped index folds into memory.
+    void fold();
+    // The filter's false positive rate at its current load
+    double get_fp_rate() const { return bf.get_fp_rate(); }
+    size_t get_filter_bits() const { return bf.get_bits(); }
     std::string get_stats() const;
     
     void save(std::ostream& out) const;
-    void load(std::istream& in);
+    void load(std::istream& in, uint32_t version = KEBAB_FILE_VERSION, const std::shared_ptr<const MappedFile>& mapping = nullptr);
 
 private:
     size_t k;
@@ -45,20 +137,67 @@ private:
     bool build_rev_comp;
     bool scan_rev_comp;
     Filter bf;
-
-    struct PendingKmer {
-        PrefetchInfo prefetch_info;
-        size_t pos;
-
-        PendingKmer(size_t num_hashes) : prefetch_info(num_hashes), pos(0) {}
+    size_t prefetch_distance;
+
+    size_t partition_shift; // a filter bit's partition is bit >> partition_shift
+    std::vector<std::mutex> partition_locks;
+
+    // Bulk hashing doesn't touch the rolling state, so one hasher per index is shared by all threads
+    NtHash<> build_hasher;
+    NtHash<> scan_hasher;
+
+    // Build and scan loops compiled for one hash count (0 for any count) and k-mer mode,
+    // picked from a table once the index's parameters are known so the per k-mer work has no mode branches
+    using BuildKernel = void (KebabIndex::*)(const char* seq, size_t len);
+    using ScanKernel = void (KebabIndex::*)(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const;
+
+    using BatchScanKernel = void (KebabIndex::*)(const Sequence* reads, size_t count, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const;
+
+    using BufferedBuildKernel = void (KebabIndex::*)(const char* seq, size_t len, BuildContext& context);
+    using HashBuildKernel = void (KebabIndex::*)(const uint64_t* hashes, size_t count, BuildContext& context);
+
+    struct Kernels {
+        BuildKernel add_sequence;
+        BufferedBuildKernel add_sequence_buffered;
+        HashBuildKernel add_hashes;
+        ScanKernel scan_read_direct;
+        ScanKernel scan_read_prefetch;
+        ScanKernel scan_read_skip_direct;
+        ScanKernel scan_read_skip_prefetch;
+        BatchScanKernel scan_batch_prefetch;
     };
+    Kernels kernels;
 
-    std::vector<Fragment> scan_read(const char* seq, size_t len, NtHash<>& scan_hasher, uint64_t min_mem_length, bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS);
-    std::vector<Fragment> scan_read_prefetch(const char* seq, size_t len, NtHash<>& scan_hasher, uint64_t min_mem_length, bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS);
+    void select_kernels();
 
-    uint64_t scan_hash(const NtHash<>& hasher) const {
-        return (scan_rev_comp) ? hasher.hash_canonical() : hasher.hash();
-    }
+    template<size_t NumHashes, KmerMode Mode>
+    static constexpr Kernels specialised_kernels();
+    template<size_t... NumHashes>
+    static constexpr std::array<std::array<Kernels, NUM_KMER_MODES>, sizeof...(NumHashes)> kernel_table(std::index_sequence<NumHashes...>);
+
+    template<size_t NumHashes, KmerMode Mode>
+    void add_sequence(const char* seq, size_t len);
+    template<size_t NumHashes, KmerMode Mode>
+    void add_sequence_buffered(const char* seq, size_t len, BuildContext& context);
+    template<size_t NumHashes>
+    void add_hashes(const uint64_t* hashes, size_t count, BuildContext& context);
+    template<size_t NumHashes>
+    void buffer_bits(uint64_t hash, BuildContext& context);
+    void init_context(BuildContext& context) const;
+    void init_partitions();
+    void flush_partition(BuildContext& context, size_t partition);
+
+    // Throws std::invalid_argument for options no scan can honour
+    void check_scan_options(uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const;
+
+    template<size_t NumHashes, KmerMode Mode>
+    void scan_read_direct(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const;
+    template<size_t NumHashes, KmerMode Mode>
+    void scan_read_prefetch(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const;
+    template<size_t NumHashes, KmerMode Mode>
+    void scan_batch_prefetch(const Sequence* reads, size_t count, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const;
+    template<size_t NumHashes, KmerMode Mode, bool Prefetch>
+    void scan_read_skip(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const;
 };
 
 } // namespace kebab
@@ -0,0 +1,34 @@
+#ifndef KEBAB_MAPPED_FILE_HPP
+#define KEBAB_MAPPED_FILE_HPP
+
+#include <string>
+#include <cstddef>
+
+namespace kebab {
+
+struct MapOptions {
+    bool populate = false;      // Pre-fault the whole mapping (MAP_POPULATE)
+    bool huge_pages = false;    // Ask the kernel to back the mapping with transparent huge pages
+};
+
+// Read-only, shared mapping of a whole file. Pages come from the page cache,
+// so concurrent processes mapping the same index share a single physical copy.
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path, MapOptions options = MapOptions());
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const noexcept { return addr; }
+    size_t size() const noexcept { return len; }
+
+private:
+    char* addr;
+    size_t len;
+};
+
+} // namespace kebab
+
+#endif // KEBAB_MAPPED_FILE_HPP
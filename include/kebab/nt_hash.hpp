@@ -11,6 +11,17 @@
 
 namespace kebab {
 
+// Implementation used by NtHash::hash_all, AUTO picks the fastest one the CPU supports
+enum class HashKernel {
+    AUTO,
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+HashKernel detect_hash_kernel() noexcept; // widest kernel the CPU supports
+const char* hash_kernel_name(HashKernel kernel) noexcept;
+
 template<typename T = uint64_t>
 class NtHash {
 public:
@@ -31,6 +42,49 @@ public:
     [[nodiscard]] T hash_rc() const noexcept { return hash_val_rc; }
     [[nodiscard]] T hash_canonical() const noexcept { return rev_comp ? std::min(hash_val, hash_val_rc) : hash_val; }
 
+    // Hashes all len - k + 1 k-mers of seq at once, independent of the rolling state.
+    // out[i] is the hash of the k-mer starting at i (canonical if requested), out_rc[i] its reverse complement hash if out_rc is given.
+    // Canonical and reverse complement hashes require rev_comp. Vector kernels hash several consecutive k-mers per step.
+    void hash_all(const char* seq, size_t len, T* out, T* out_rc = nullptr, bool canonical = false, HashKernel kernel = HashKernel::AUTO) const noexcept;
+
+    // Calls visit(pos, hash, hash_rc) for every k-mer of seq in order, where pos is the position of the k-mer's last character.
+    // Hashes are computed in bulk by hash_all, hash_rc is 0 unless WithRc is set.
+    // The mode is a template parameter so the visiting loop carries no per k-mer branches.
+    // K-mers containing an ambiguous base (anything but A, C, G or T in either case) are never hashed or visited,
+    // instead skip(first, last) is called once per run of them with the positions of its first and last k-mer.
+    // Hashing restarts from the base after each ambiguous one, so a run of Ns costs a single pass over its bases.
+    template<bool Canonical, bool WithRc, typename Visitor, typename SkipVisitor>
+    void for_each_kmer(const char* seq, size_t len, Visitor visit, SkipVisitor skip) const {
+        if (len < k) {
+            return;
+        }
+        size_t next_pos = k - 1; // position of the first k-mer not yet visited or skipped
+        size_t run_start = 0;
+        while (run_start + k <= len) {
+            const size_t run_end = find_ambiguous(seq, run_start, len);
+            if (run_end - run_start >= k) {
+                if (run_start + k - 1 > next_pos) {
+                    skip(next_pos, run_start + k - 2);
+                }
+                for_each_kmer_in_run<Canonical, WithRc>(seq, run_start, run_end, visit);
+                next_pos = run_end;
+            }
+            run_start = run_end + 1;
+        }
+        if (next_pos < len) {
+            skip(next_pos, len - 1);
+        }
+    }
+
+    // Same, ignoring k-mers with ambiguous bases
+    template<bool Canonical, bool WithRc, typename Visitor>
+    void for_each_kmer(const char* seq, size_t len, Visitor visit) const {
+        for_each_kmer<Canonical, WithRc>(seq, len, visit, [](size_t, size_t) {});
+    }
+
+    // Position of the first ambiguous base of seq at or after from, len if there is none
+    static size_t find_ambiguous(const char* seq, size_t from, size_t len) noexcept;
+
 private:
     size_t k;
     bool rev_comp;
@@ -47,6 +101,28 @@ private:
     void init_rol_k_map() noexcept;
     void init_rol_k_map_rc() noexcept;
 
+    // Visits the k-mers of seq[run_start, run_end), which has no ambiguous bases
+    template<bool Canonical, bool WithRc, typename Visitor>
+    void for_each_kmer_in_run(const char* seq, size_t run_start, size_t run_end, Visitor& visit) const {
+        T hashes[HASH_BATCH_KMERS];
+        T hashes_rc[WithRc ? HASH_BATCH_KMERS : 1];
+
+        const size_t num_kmers = run_end - run_start - k + 1;
+        for (size_t first = 0; first < num_kmers; first += HASH_BATCH_KMERS) {
+            const size_t count = std::min(HASH_BATCH_KMERS, num_kmers - first);
+            const size_t first_pos = run_start + first + k - 1;
+            hash_all(seq + run_start + first, count + k - 1, hashes, WithRc ? hashes_rc : nullptr, Canonical);
+            for (size_t i = 0; i < count; ++i) {
+                if constexpr (WithRc) {
+                    visit(first_pos + i, hashes[i], hashes_rc[i]);
+                }
+                else {
+                    visit(first_pos + i, hashes[i], T{0});
+                }
+            }
+        }
+    }
+
     static inline T rol(T v, size_t n) noexcept;
     static inline T ror(T v, size_t n) noexcept;
 };
@@ -0,0 +1,128 @@
+#ifndef KEBAB_OUTPUT_WRITER_HPP
+#define KEBAB_OUTPUT_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <cstdio>
+
+namespace kebab {
+
+namespace detail {
+constexpr char DIGIT_PAIRS[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+} // namespace detail
+
+// Writes the decimal form of v ending just before end, returns a pointer to the first digit
+inline char* format_uint(uint64_t v, char* end) noexcept {
+    while (v >= 100) {
+        const char* pair = detail::DIGIT_PAIRS + (v % 100) * 2;
+        v /= 100;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    if (v >= 10) {
+        const char* pair = detail::DIGIT_PAIRS + v * 2;
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+    else {
+        *--end = static_cast<char>('0' + v);
+    }
+    return end;
+}
+
+// Formatted output for one batch of input, keeps its capacity when reused
+class OutputBuffer {
+public:
+    void append(const char* s, size_t n) { data.append(s, n); }
+    void append(const char* s) { data.append(s); }
+    void append(char c) { data.push_back(c); }
+
+    void append_uint(uint64_t v) {
+        char digits[20];
+        char* end = digits + sizeof(digits);
+        char* begin = format_uint(v, end);
+        data.append(begin, end - begin);
+    }
+
+    // For encoders that build binary records in place
+    std::string& bytes() noexcept { return data; }
+
+    void clear() noexcept { data.clear(); }
+    const char* c_str() const noexcept { return data.data(); }
+    size_t size() const noexcept { return data.size(); }
+    bool empty() const noexcept { return data.empty(); }
+
+private:
+    friend class OutputWriter;
+
+    std::string data;
+    size_t slot = 0; // owning slot in the writer
+};
+
+// Workers fill buffers in parallel and a dedicated thread writes them to the file.
+// When ordered, buffers are written by increasing id (ids must be consecutive from 0), otherwise as they complete.
+class OutputWriter {
+public:
+    OutputWriter(FILE* out, size_t num_buffers, bool ordered);
+    ~OutputWriter();
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    // Blocks until a buffer is free (and, when ordered, until id is within the reorder window)
+    OutputBuffer& acquire(size_t id);
+    void submit(OutputBuffer& buffer);
+
+    // Writes everything submitted so far and stops the writer thread. False if a write failed or
+    // fell short (e.g., the disk filled up), after which nothing more is written.
+    bool finish();
+
+    // Time the writer thread has spent writing, complete once finished
+    uint64_t get_write_nanos() const noexcept { return write_nanos; }
+
+private:
+    enum class SlotState { FREE, FILLING, READY };
+
+    struct Slot {
+        OutputBuffer buffer;
+        SlotState state = SlotState::FREE;
+        size_t id = 0;
+    };
+
+    FILE* out;
+    bool ordered;
+
+    std::vector<Slot> slots;
+    std::deque<size_t> free_slots;  // unordered only
+    std::deque<size_t> ready_slots; // unordered only
+    size_t next_id;                 // ordered only, next id to be written
+
+    std::mutex mutex;
+    std::condition_variable slot_freed;
+    std::condition_variable slot_ready;
+    bool done;
+    bool failed; // writer thread only, until joined
+    uint64_t write_nanos;
+    std::thread writer;
+
+    void run();
+};
+
+} // namespace kebab
+
+#endif // KEBAB_OUTPUT_WRITER_HPP
@@ -0,0 +1,100 @@
+#ifndef KEBAB_RUN_STATS_HPP
+#define KEBAB_RUN_STATS_HPP
+
+#include <string>
+#include <vector>
+#include <array>
+#include <utility>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+#include "constants.hpp"
+
+namespace kebab {
+
+// Where a thread's time goes. Hashing and filter probes alternate every k-mer, so they're timed together.
+enum class Phase {
+    PARSE,       // reader: reading, decompressing and parsing records
+    PARSE_WAIT,  // reader: waiting for a free batch, workers are behind
+    INPUT_WAIT,  // worker: waiting for a parsed batch, input is behind
+    SKETCH,      // estimate: hashing k-mers into the sketch (and spool)
+    INSERT,      // build: hashing k-mers and setting their filter bits
+    LOOKUP,      // scan: hashing k-mers and querying the filter
+    SELECT,      // scan: picking, sorting and merging fragments
+    FORMAT,      // scan: formatting fragments into output buffers
+    OUTPUT_WAIT, // scan: waiting for an output buffer, the writer is behind
+    WRITE        // writer: writing buffers to the file
+};
+static constexpr size_t NUM_PHASES = 10;
+
+// Fragments kept by one output of a scan
+struct FragmentCounts {
+    uint64_t fragments = 0;
+    uint64_t bases = 0;
+};
+
+// Counters and phase times of one thread, padded so threads never write to the same cache line
+struct alignas(STATS_ALIGNMENT) ThreadStats {
+    uint64_t reads = 0;
+    uint64_t bases = 0;
+    uint64_t kmers = 0;       // queried by a scan, inserted by a build (twice for both strands)
+    uint64_t kmer_misses = 0; // scan only, k-mers the filter doesn't contain
+    std::vector<FragmentCounts> outputs;
+    std::array<uint64_t, NUM_PHASES> phase_nanos{};
+
+    // Starts the clock, phases are only timed once started
+    void start() noexcept {
+        timed = true;
+        last = now();
+    }
+
+    // Charges the time since the last lap (or start) to phase
+    void lap(Phase phase) noexcept {
+        if (timed) {
+            const uint64_t t = now();
+            phase_nanos[static_cast<size_t>(phase)] += t - last;
+            last = t;
+        }
+    }
+
+private:
+    bool timed = false;
+    uint64_t last = 0;
+
+    static uint64_t now() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+};
+
+// Statistics of a build or scan, gathered per thread and summed when written. Counting is always on,
+// timing costs a clock read per phase change so only runs when timed.
+class RunStats {
+public:
+    RunStats(bool timed, size_t threads, size_t outputs = 0);
+
+    // Restarts every thread's clock, so time between passes over the input isn't charged to a phase
+    void restart() noexcept;
+
+    // Slots for OpenMP worker thread i, the reader thread and the writer thread
+    ThreadStats& worker(size_t i) noexcept { return workers[i]; }
+    ThreadStats& reader() noexcept { return io[0]; }
+    ThreadStats& writer() noexcept { return io[1]; }
+
+    // Extra top level values, e.g. a build's estimate
+    void set(const std::string& name, double value);
+
+    // Throws std::runtime_error if the file cannot be written
+    void write_json(const std::string& path, const std::string& command, const std::vector<uint64_t>& min_mem_lengths = {}) const;
+
+private:
+    bool timed;
+    std::chrono::steady_clock::time_point start_time;
+    std::vector<ThreadStats> workers;
+    std::array<ThreadStats, 2> io;
+    std::vector<std::pair<std::string, double>> values;
+};
+
+} // namespace kebab
+
+#endif // KEBAB_RUN_STATS_HPP
@@ -0,0 +1,250 @@
+#ifndef KEBAB_SEQ_BATCH_HPP
+#define KEBAB_SEQ_BATCH_HPP
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <omp.h>
+
+#include "constants.hpp"
+
+#include "kebab/run_stats.hpp"
+
+namespace kebab {
+
+// Stores sequence information for multi-threaded processing
+struct SeqInfo {
+    const char* seq_content;
+    const char* seq_name;
+    const char* seq_qual; // seq_len quality characters, nullptr unless kept
+    int64_t seq_len;
+    int64_t seq_name_len;
+    int64_t seq_comment_len;
+    uint8_t mate;         // 1 or 2 for paired-end reads, 0 otherwise
+
+    // Records longer than SEQ_CHUNK_BASES may arrive split into chunks, see SplitRecord. seq_content, seq_qual and
+    // seq_len are then the chunk's, and the whole record starts seq_offset bases before seq_content.
+    int64_t seq_offset = 0; // of the chunk in its record
+    int64_t record_len = 0; // of the whole record
+    uint32_t chunk = 0;
+    uint32_t num_chunks = 1;
+
+    bool is_chunk() const noexcept { return num_chunks > 1; }
+    bool is_last_chunk() const noexcept { return chunk + 1 == num_chunks; }
+};
+
+// Copy of a record too long for one worker, shared by the batches holding its chunks so that consecutive
+// batches can be processed in parallel. Every chunk after the first starts with the previous chunk's last
+// overlap bases, so each k-mer lies in exactly one chunk.
+struct SplitRecord {
+    std::string seq;
+    std::string name;
+    std::string qual; // empty unless kept
+    size_t comment_len;
+    size_t overlap;
+    uint32_t num_chunks;
+
+    SplitRecord(const char* seq, size_t seq_len, const char* name, size_t name_len, size_t comment_len, const char* qual, size_t overlap)
+        : seq(seq, seq_len)
+        , name(name, name_len)
+        , qual(qual ? std::string(qual, seq_len) : std::string())
+        , comment_len(comment_len)
+        , overlap(overlap)
+        , num_chunks(static_cast<uint32_t>((seq_len + SEQ_CHUNK_BASES - 1) / SEQ_CHUNK_BASES))
+    {}
+};
+
+// Consecutive records whose names and sequences are packed into one arena, reused across fills
+class SeqBatch {
+public:
+    SeqBatch() : id(0), first_record(0), arena(), arena_used(0), chunk_bytes(0), records(), split_records() {}
+
+    void clear() noexcept {
+        arena_used = 0;
+        chunk_bytes = 0;
+        records.clear();
+        split_records.clear();
+        // Don't hold on to memory from an unusually long record
+        if (arena.capacity() > SEQ_BATCH_MAX_RETAINED) {
+            std::vector<char>().swap(arena);
+        }
+    }
+
+    // Copies a record in, all strings are null terminated in the arena. qual, if given, holds seq_len characters.
+    void add(const char* seq, size_t seq_len, const char* name, size_t name_len, size_t comment_len, const char* qual = nullptr, uint8_t mate = 0) {
+        char* dest = reserve(seq_len + name_len + 2 + (qual ? seq_len + 1 : 0));
+        std::memcpy(dest, seq, seq_len);
+        dest[seq_len] = '\0';
+        char* dest_name = dest + seq_len + 1;
+        std::memcpy(dest_name, name, name_len);
+        dest_name[name_len] = '\0';
+        char* dest_qual = nullptr;
+        if (qual) {
+            dest_qual = dest_name + name_len + 1;
+            std::memcpy(dest_qual, qual, seq_len);
+            dest_qual[seq_len] = '\0';
+        }
+
+        records.push_back({dest, dest_name, dest_qual, static_cast<int64_t>(seq_len), static_cast<int64_t>(name_len), static_cast<int64_t>(comment_len), mate,
+                           0, static_cast<int64_t>(seq_len)});
+    }
+
+    // Adds a chunk of a split record, which stays in the record's own copy rather than the arena
+    void add_chunk(const std::shared_ptr<const SplitRecord>& record, uint32_t chunk) {
+        const size_t new_start = static_cast<size_t>(chunk) * SEQ_CHUNK_BASES;
+        const size_t start = chunk ? new_start - std::min(record->overlap, new_start) : 0;
+        const size_t end = std::min(record->seq.size(), new_start + SEQ_CHUNK_BASES);
+        records.push_back({record->seq.data() + start, record->name.c_str(), record->qual.empty() ? nullptr : record->qual.data() + start,
+                           static_cast<int64_t>(end - start), static_cast<int64_t>(record->name.size()), static_cast<int64_t>(record->comment_len), 0,
+                           static_cast<int64_t>(start), static_cast<int64_t>(record->seq.size()), chunk, record->num_chunks});
+        split_records.push_back(record);
+        chunk_bytes += end - start;
+    }
+
+    bool full() const noexcept { return arena_used + chunk_bytes >= SEQ_BATCH_BYTES; }
+    bool empty() const noexcept { return records.empty(); }
+    size_t size() const noexcept { return records.size(); }
+
+    const SeqInfo& operator[](size_t i) const noexcept { return records[i]; }
+    std::vector<SeqInfo>::const_iterator begin() const noexcept { return records.begin(); }
+    std::vector<SeqInfo>::const_iterator end() const noexcept { return records.end(); }
+
+    size_t id; // position of this batch in the input, for consumers that need input order
+    size_t first_record; // position of the batch's first record in the input, record i is first_record + i (chunks count as their record)
+
+private:
+    std::vector<char> arena;
+    size_t arena_used;
+    size_t chunk_bytes;
+    std::vector<SeqInfo> records;
+    std::vector<std::shared_ptr<const SplitRecord>> split_records; // kept alive while their chunks are in this batch
+
+    char* reserve(size_t bytes) {
+        if (arena_used + bytes > arena.size()) {
+            const char* old_base = arena.data();
+            arena.resize(std::max({arena.size() * 2, arena_used + bytes, SEQ_BATCH_BYTES}));
+            // Rebase records already packed into the old arena, chunks live in their split record
+            for (SeqInfo& record : records) {
+                if (record.is_chunk()) {
+                    continue;
+                }
+                record.seq_content = arena.data() + (record.seq_content - old_base);
+                record.seq_name = arena.data() + (record.seq_name - old_base);
+                if (record.seq_qual) {
+                    record.seq_qual = arena.data() + (record.seq_qual - old_base);
+                }
+            }
+        }
+        char* dest = arena.data() + arena_used;
+        arena_used += bytes;
+        return dest;
+    }
+};
+
+// Blocking FIFO of batches, pop returns false once closed and drained
+class BatchQueue {
+public:
+    void push(SeqBatch* batch) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            batches.push_back(batch);
+        }
+        cv.notify_one();
+    }
+
+    bool pop(SeqBatch*& batch) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !batches.empty() || closed; });
+        if (batches.empty()) {
+            return false;
+        }
+        batch = batches.front();
+        batches.pop_front();
+        return true;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closed = true;
+        }
+        cv.notify_all();
+    }
+
+private:
+    std::deque<SeqBatch*> batches;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool closed = false;
+};
+
+// A dedicated thread fills batches with read_record(SeqBatch&) -> bool (false at end of input),
+// which may add a record whole or a chunk of one (a full batch takes the next chunk),
+// while OpenMP workers claim whole batches and hand them to process_batch(const SeqBatch&).
+// With stats, the reader counts records and times parsing and waits, workers time their waits for batches.
+template<typename ReadFunc, typename ProcessFunc>
+void process_batches(ReadFunc read_record, uint16_t threads, ProcessFunc process_batch, RunStats* stats = nullptr) {
+    std::vector<SeqBatch> pool(static_cast<size_t>(threads) * SEQ_BATCHES_PER_THREAD + 1);
+    BatchQueue free_batches;
+    BatchQueue full_batches;
+    for (SeqBatch& batch : pool) {
+        free_batches.push(&batch);
+    }
+
+    std::thread reader([&]() {
+        ThreadStats untracked;
+        ThreadStats& reader_stats = stats ? stats->reader() : untracked;
+        size_t next_id = 0;
+        size_t next_record = 0;
+        SeqBatch* batch;
+        bool more = true;
+        while (more && free_batches.pop(batch)) {
+            reader_stats.lap(Phase::PARSE_WAIT);
+            batch->clear();
+            while (!batch->full() && (more = read_record(*batch))) {}
+            reader_stats.lap(Phase::PARSE);
+            if (batch->empty()) {
+                break;
+            }
+            // A split record counts once, at its last chunk, and until then is the next record of the input
+            size_t records_ended = 0;
+            for (const SeqInfo& record : *batch) {
+                if (record.is_last_chunk()) {
+                    ++records_ended;
+                    reader_stats.bases += record.record_len;
+                }
+            }
+            reader_stats.reads += records_ended;
+            batch->id = next_id++;
+            batch->first_record = next_record;
+            next_record += records_ended;
+            full_batches.push(batch);
+        }
+        full_batches.close();
+    });
+
+    #pragma omp parallel
+    {
+        ThreadStats untracked;
+        ThreadStats& worker_stats = stats ? stats->worker(omp_get_thread_num()) : untracked;
+        SeqBatch* batch;
+        while (full_batches.pop(batch)) {
+            worker_stats.lap(Phase::INPUT_WAIT);
+            process_batch(static_cast<const SeqBatch&>(*batch));
+            free_batches.push(batch);
+        }
+    }
+
+    reader.join();
+}
+
+} // namespace kebab
+
+#endif // KEBAB_SEQ_BATCH_HPP
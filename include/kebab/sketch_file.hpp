@@ -0,0 +1,26 @@
+#ifndef KEBAB_SKETCH_FILE_HPP
+#define KEBAB_SKETCH_FILE_HPP
+
+#include <string>
+#include <cstdint>
+
+#include "constants.hpp"
+
+#include "external/hll/hll.h"
+
+namespace kebab {
+
+// Cardinality sketches of a sequence file's k-mers are saved beside it, one per k and k-mer mode,
+// so builds sweeping other settings (-e, -f, ...) skip estimation. A sketch is only used while the
+// file's size and modification time still match those it was made from.
+std::string sketch_path(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode);
+
+// True if a matching sketch was read into hll
+bool load_sketch(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode, hll::hll_t& hll);
+
+// Throws std::runtime_error if the sketch cannot be written
+void save_sketch(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode, const hll::hll_t& hll);
+
+} // namespace kebab
+
+#endif // KEBAB_SKETCH_FILE_HPP
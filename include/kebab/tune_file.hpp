@@ -0,0 +1,30 @@
+#ifndef KEBAB_TUNE_FILE_HPP
+#define KEBAB_TUNE_FILE_HPP
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "constants.hpp"
+
+namespace kebab {
+
+// Scan settings measured by kebab tune against one index on one machine
+struct TuneResult {
+    size_t prefetch_distance = PREFETCH_DISTANCE; // filter lines kept in flight, 0 if scanning without prefetching was fastest
+    uint16_t threads = 1;                         // fewest threads within TUNE_THREAD_TOLERANCE of the best throughput
+};
+
+// Tuned settings are saved beside the index as [INDEX].tune. They are only used while the index's size and
+// modification time match, and on a machine with the same CPU model and number of processors.
+std::string tune_path(const std::string& index_file);
+
+// True if matching settings were read into result
+bool load_tune(const std::string& index_file, TuneResult& result);
+
+// Throws std::runtime_error if the settings cannot be written
+void save_tune(const std::string& index_file, const TuneResult& result);
+
+} // namespace kebab
+
+#endif // KEBAB_TUNE_FILE_HPP
@@ -27,6 +27,7 @@ SOFTWARE.
 #include "external/hll/hll.h"
 #include <stdexcept>
 #include <cstring>
+#include <algorithm>
 namespace hll {
 
 constexpr long double TWO_POW_32 = (1ull << 32) * 1.;
@@ -81,24 +82,26 @@ hll_t const &hll_t::operator+=(const hll_t &other) {
         throw std::runtime_error(buf);
     }
     unsigned i;
+    // A union keeps the larger rank of each register (OR-ing ranks would overestimate)
 #if HAS_AVX_512
     __m512i *els(reinterpret_cast<__m512i *>(core_.data()));
     const __m512i *oels(reinterpret_cast<const __m512i *>(other.core_.data()));
-    for(i = 0; i < m_ >> 6; ++i) els[i] = _mm512_or_epi64(els[i], oels[i]);
-    if(m_ < 64) for(;i < m_; ++i) core_[i] |= other.core_[i];
+    for(i = 0; i < m_ >> 6; ++i) els[i] = _mm512_max_epu8(els[i], oels[i]);
+    if(m_ < 64) for(;i < m_; ++i) core_[i] = std::max(core_[i], other.core_[i]);
 #elif __AVX2__
     __m256i *els(reinterpret_cast<__m256i *>(core_.data()));
     const __m256i *oels(reinterpret_cast<const __m256i *>(other.core_.data()));
-    for(i = 0; i < m_ >> 5; ++i) els[i] = _mm256_or_si256(els[i], oels[i]);
-    if(m_ < 32) for(;i < m_; ++i) core_[i] |= other.core_[i];
+    for(i = 0; i < m_ >> 5; ++i) els[i] = _mm256_max_epu8(els[i], oels[i]);
+    if(m_ < 32) for(;i < m_; ++i) core_[i] = std::max(core_[i], other.core_[i]);
 #elif __SSE2__
     __m128i *els(reinterpret_cast<__m128i *>(core_.data()));
     const __m128i *oels(reinterpret_cast<const __m128i *>(other.core_.data()));
-    for(i = 0; i < m_ >> 4; ++i) els[i] = _mm_or_si128(els[i], oels[i]);
-    if(m_ < 16) for(; i < m_; ++i) core_[i] |= other.core_[i];
+    for(i = 0; i < m_ >> 4; ++i) els[i] = _mm_max_epu8(els[i], oels[i]);
+    if(m_ < 16) for(; i < m_; ++i) core_[i] = std::max(core_[i], other.core_[i]);
 #else
-    for(i = 0; i < m_; ++i) core_[i] |= other.core_[i];
+    for(i = 0; i < m_; ++i) core_[i] = std::max(core_[i], other.core_[i]);
 #endif
+    is_calculated_ = 0;
     return *this;
 }
 
@@ -127,6 +130,7 @@ hll_t const &hll_t::operator&=(const hll_t &other) {
 #else
     for(i = 0; i < m_; ++i) core_[i] = std::min(core_[i], other.core_[i]);
 #endif
+    is_calculated_ = 0;
     return *this;
 }
 
@@ -190,6 +194,15 @@ std::string hll_t::desc_string() const {
     return buf;
 }
 
+void hll_t::write(std::ostream &out) const {
+    out.write(reinterpret_cast<const char *>(core_.data()), core_.size());
+}
+
+void hll_t::read(std::istream &in) {
+    in.read(reinterpret_cast<char *>(core_.data()), core_.size());
+    is_calculated_ = 0;
+}
+
 void hll_t::free() {
     core_.resize(0);
     core_.shrink_to_fit();
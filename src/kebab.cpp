@@ -1,9 +1,17 @@
 #include <string>
+#include <memory>
+#include <cstring>
 #include <stdio.h>
 #include <fstream>
 #include <unistd.h>
 #include <chrono>
+#include <atomic>
 #include <filesystem>
+#include <optional>
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <random>
 #include <omp.h>
 
 #include "external/kseq.h"
@@ -11,145 +19,341 @@
 #include "external/hll/hll.h"
 
 #include "kebab/kebab_index.hpp"
+#include "kebab/index_file.hpp"
 #include "kebab/nt_hash.hpp"
+#include "kebab/mapped_file.hpp"
+#include "kebab/seq_batch.hpp"
+#include "kebab/output_writer.hpp"
+#include "kebab/input_stream.hpp"
+#include "kebab/hash_spool.hpp"
+#include "kebab/sketch_file.hpp"
+#include "kebab/fragment_file.hpp"
+#include "kebab/run_stats.hpp"
+#include "kebab/tune_file.hpp"
+#include "kebab/file_util.hpp"
 
 #include "constants.hpp"
 #include "util.hpp"
 
 /* =============================== UTILITIES =============================== */
 
-KSEQ_INIT(int, read)
+int read_input(kebab::InputStream* input, void* buf, int len) {
+    return input->read(buf, len);
+}
 
-kseq_t* open_fasta(const std::string& fasta_file, FILE** fp) {
-    *fp = fopen(fasta_file.c_str(), "r");
-    if (!*fp) {
-        if (errno == ENOENT) {
-            error_exit("File not found (" + fasta_file + ")");
-        } else {
-            error_exit("Problem opening file (" + fasta_file + "), " + strerror(errno));
-        }
-        return nullptr;
+KSEQ_INIT(kebab::InputStream*, read_input)
+
+// A FASTA or FASTQ file being parsed
+struct SeqFile {
+    std::unique_ptr<kebab::InputStream> input;
+    kseq_t* seq = nullptr;
+    std::string error; // malformed input that ended parsing early, set by the reader thread
+    bool fastq = false; // a record with qualities has been read
+};
+
+// Plain or gzip/BGZF compressed, BGZF input is decompressed by up to threads threads
+void open_seq_file(const std::string& seq_file, uint16_t threads, SeqFile& file) {
+    try {
+        file.input = std::make_unique<kebab::InputStream>(seq_file, threads);
+    } catch (const std::runtime_error& e) {
+        error_exit(e.what());
     }
-    return kseq_init(fileno(*fp));
+    file.seq = kseq_init(file.input.get());
 }
 
-// Stores sequence information for multi-threaded processing
-struct SeqInfo {
-    char* seq_content;
-    char* seq_name;
+// Reports read or decompression errors and malformed records that ended the input early
+void close_seq_file(SeqFile& file) {
+    kseq_destroy(file.seq);
+    file.seq = nullptr;
+    if (file.input->failed()) {
+        error_exit(file.input->get_error());
+    }
+    if (!file.error.empty()) {
+        error_exit(file.error);
+    }
+    file.input.reset();
+}
+
+using kebab::SeqInfo;
+
+// Reads the next record, skipping empty ones unless they are mates. False at the end of input or on a malformed record.
+bool read_seq_record(SeqFile& file, bool skip_empty) {
     int64_t seq_len;
-    int64_t seq_name_len;
-    int64_t seq_comment_len;
-};
+    while ((seq_len = kseq_read(file.seq)) == 0 && skip_empty) {}
+    if (seq_len == -2) {
+        file.error = "Truncated quality string in record " + std::string(file.seq->name.s, file.seq->name.l);
+    }
+    else if (seq_len == -3) {
+        file.error = "Problem reading sequence input";
+    }
+    else if (seq_len > 0) {
+        // kseq parses a FASTQ record cut off before its '+' line as FASTA
+        if (file.fastq && file.seq->qual.l == 0) {
+            file.error = "Truncated FASTQ record " + std::string(file.seq->name.s, file.seq->name.l);
+            return false;
+        }
+        file.fastq = file.seq->qual.l > 0;
+    }
+    return seq_len >= 0;
+}
 
-template<typename ProcessFunc>
-void process_sequences(kseq_t* seq, uint16_t threads, ProcessFunc process_func) {
-    #pragma omp parallel
-    {
-        SeqInfo seq_info;
-        while (true) {
-            #pragma omp critical(read_seq)
-            {
-                seq_info.seq_len = kseq_read(seq);
-                if (seq_info.seq_len >= 0) {
-                    if (threads > 1) {
-                        seq_info.seq_content = strdup(seq->seq.s);
-                        seq_info.seq_name = strdup(seq->name.s);  // Copy name for multi-threaded
-                    } 
-                    // avoid extra copy for single thread
-                    else {
-                        seq_info.seq_content = seq->seq.s;
-                        seq_info.seq_name = seq->name.s;
-                    }
-                    seq_info.seq_name_len = seq->name.l;
-                    seq_info.seq_comment_len = seq->comment.l;
-                }
+bool keep_record(SeqFile& file, bool with_qualities) {
+    if (with_qualities && file.seq->qual.l == 0 && file.seq->seq.l > 0) {
+        file.error = "Record " + std::string(file.seq->name.s, file.seq->name.l) + " has no quality string, FASTQ input is required";
+        return false;
+    }
+    return true;
+}
+
+// Mates named NAME/1 and NAME/2 share NAME
+size_t mate_name_len(const kseq_t* seq) {
+    const size_t len = seq->name.l;
+    if (len >= 2 && seq->name.s[len - 2] == '/' && (seq->name.s[len - 1] == '1' || seq->name.s[len - 1] == '2')) {
+        return len - 2;
+    }
+    return len;
+}
+
+// chunk_overlap that keeps every record whole
+static constexpr size_t NO_SPLIT = std::numeric_limits<size_t>::max();
+
+// Records are parsed by a dedicated reader thread into batches, which worker threads claim whole.
+// With a mate file, its records pair up with the file's in order and each pair lands in one batch, mate 1 first.
+// Otherwise, unless chunk_overlap is NO_SPLIT, records longer than SEQ_CHUNK_BASES are split into chunks overlapping
+// by chunk_overlap bases (see SplitRecord), one per batch, so a chromosome keeps every worker busy.
+template<typename BatchFunc>
+void process_sequence_batches(SeqFile& file, uint16_t threads, BatchFunc process_batch, bool with_qualities = false, SeqFile* mate_file = nullptr, kebab::RunStats* stats = nullptr, size_t chunk_overlap = NO_SPLIT) {
+    auto add_record = [with_qualities](kebab::SeqBatch& batch, const kseq_t* seq, size_t name_len, uint8_t mate) {
+        batch.add(seq->seq.s, seq->seq.l, seq->name.s, name_len, seq->comment.l, with_qualities ? seq->qual.s : nullptr, mate);
+    };
+
+    // Record being split and its next chunk, the reader only hands out chunks until it's done
+    std::shared_ptr<const kebab::SplitRecord> split;
+    uint32_t next_chunk = 0;
+
+    auto read_record = [&](kebab::SeqBatch& batch) {
+        if (!split) {
+            if (!read_seq_record(file, true) || !keep_record(file, with_qualities)) {
+                return false;
             }
-            if (seq_info.seq_len <= 0) {
-                break;
+            const kseq_t* seq = file.seq;
+            if (chunk_overlap == NO_SPLIT || seq->seq.l <= SEQ_CHUNK_BASES) {
+                add_record(batch, seq, seq->name.l, 0);
+                return true;
             }
+            split = std::make_shared<const kebab::SplitRecord>(seq->seq.s, seq->seq.l, seq->name.s, seq->name.l, seq->comment.l, with_qualities ? seq->qual.s : nullptr, chunk_overlap);
+            next_chunk = 0;
+        }
+        batch.add_chunk(split, next_chunk);
+        if (++next_chunk == split->num_chunks) {
+            split.reset();
+        }
+        return true;
+    };
+
+    auto read_pair = [&](kebab::SeqBatch& batch) {
+        const bool more = read_seq_record(file, false);
+        const bool more_mates = read_seq_record(*mate_file, false);
+        if (!file.error.empty() || !mate_file->error.empty()) {
+            return false;
+        }
+        if (more != more_mates) {
+            file.error = "Paired inputs have different numbers of reads";
+            return false;
+        }
+        if (!more || !keep_record(file, with_qualities) || !keep_record(*mate_file, with_qualities)) {
+            return false;
+        }
 
+        const size_t name_len = mate_name_len(file.seq);
+        if (name_len != mate_name_len(mate_file->seq) || std::memcmp(file.seq->name.s, mate_file->seq->name.s, name_len) != 0) {
+            file.error = "Mates are out of order, " + std::string(file.seq->name.s, file.seq->name.l) + " is paired with " + std::string(mate_file->seq->name.s, mate_file->seq->name.l);
+            return false;
+        }
+        add_record(batch, file.seq, name_len, 1);
+        add_record(batch, mate_file->seq, name_len, 2);
+        return true;
+    };
+
+    if (mate_file) {
+        kebab::process_batches(read_pair, threads, process_batch, stats);
+    }
+    else {
+        kebab::process_batches(read_record, threads, process_batch, stats);
+    }
+}
+
+// Hands each record, or chunk of a long one, to process_func
+template<typename ProcessFunc>
+void process_sequences(SeqFile& file, uint16_t threads, ProcessFunc process_func, kebab::RunStats* stats = nullptr, size_t chunk_overlap = NO_SPLIT) {
+    process_sequence_batches(file, threads, [&](const kebab::SeqBatch& batch) {
+        for (const SeqInfo& seq_info : batch) {
             process_func(seq_info);
         }
+    }, false, nullptr, stats, chunk_overlap);
+}
 
-        if (threads > 1) {
-            free(seq_info.seq_content);
-            free(seq_info.seq_name);
+// Percent of the file consumed, measured on the compressed file for compressed input
+double input_progress(const kebab::InputStream& input) {
+    size_t file_size = input.get_file_size();
+    return file_size ? std::min(100.0, input.get_bytes_consumed() * 100.0 / file_size) : 0.0;
+}
+
+// Query the filter in place from the page cache rather than copying it to the heap
+std::shared_ptr<const kebab::MappedFile> map_index(const std::string& index_file, const kebab::IndexHeader& header, bool populate, bool huge_pages) {
+    std::shared_ptr<const kebab::MappedFile> mapping;
+    if (header.version < ALIGNED_PAYLOAD_VERSION) {
+        note("Index uses a legacy layout that cannot be memory-mapped, loading into memory (rebuild to enable mapping)");
+    }
+    else {
+        try {
+            mapping = std::make_shared<kebab::MappedFile>(index_file, kebab::MapOptions{populate, huge_pages});
+        } catch (const std::runtime_error& e) {
+            warning(std::string(e.what()) + ", loading into memory instead");
         }
     }
+    return mapping;
 }
 
-size_t bytes_read(const SeqInfo& seq_info) {
-    // seq, header, comment, and newlines
-    return seq_info.seq_len + seq_info.seq_name_len + seq_info.seq_comment_len + 2;
+kebab::IndexHeader read_header(std::ifstream& index_stream) {
+    kebab::IndexHeader header;
+    try {
+        header = kebab::read_index_header(index_stream);
+    } catch (const std::runtime_error& e) {
+        error_exit(e.what());
+    }
+    return header;
+}
+
+// Written beside the output and renamed over it, so an index being read (or mapped) is never truncated
+template<typename Index>
+void write_index(const Index& index, const std::string& output_prefix, FilterSizeMode filter_size_mode, FilterType filter_type) {
+    try {
+        kebab::write_file_atomically(output_prefix + KEBAB_FILE_SUFFIX, "index file", [&](std::ostream& out) {
+            kebab::write_index_header(out, filter_size_mode, filter_type);
+            index.save(out);
+        });
+    } catch (const std::runtime_error& e) {
+        error_exit(e.what());
+    }
+}
+
+// A filter only fills up when added to or folded after being sized, remedy says what brings the rate back down
+void check_fp_rate(double fp_rate, double max_fp_rate, const std::string& remedy) {
+    if (fp_rate > max_fp_rate) {
+        warning("Observed false positive rate (" + std::to_string(fp_rate) + ") is above " + std::to_string(max_fp_rate) + ", " + remedy);
+    }
+}
+
+// Halves the filter folds times, or with max_kb until it is at most that size, reporting what each halving costs
+template<typename Index>
+void fold_index(Index& index, size_t folds, uint64_t max_kb) {
+    auto report = [&](const std::string& step) {
+        std::cerr << "\t" << step << ": " << std::fixed << std::setprecision(2) << index.get_filter_bits() / CHAR_BIT / 1024.0
+                  << "KB, FP rate " << std::setprecision(6) << index.get_fp_rate() << std::endl;
+    };
+    std::cerr << "Folding:" << std::endl;
+    report("Unfolded");
+    for (size_t i = 0; max_kb ? index.get_filter_bits() / CHAR_BIT > max_kb * 1024 : i < folds; ++i) {
+        try {
+            index.fold();
+        } catch (const std::invalid_argument& e) {
+            error_exit(e.what());
+        }
+        report("Fold " + std::to_string(i + 1));
+    }
 }
 
 /* =============================== ESTIMATE =============================== */
 
-uint64_t card_estimate(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode, uint16_t threads) {
+// With a spool, also keeps every k-mer hash to be inserted so the build needs no second pass over the input
+// Sketches the input's k-mers into hll, each thread into its own sketch merged at the end
+void card_estimate(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode, uint16_t threads, hll::hll_t& hll, kebab::HashSpool* spool, kebab::RunStats& stats) {
     const auto start_time = std::chrono::steady_clock::now();
 
-    FILE* fp;
-    kseq_t* seq = open_fasta(fasta_file, &fp);
-
-    // For progress
-    size_t file_size = std::filesystem::file_size(fasta_file);
-    size_t bytes_processed = 0;
+    SeqFile file;
+    open_seq_file(fasta_file, threads, file);
 
     kebab::NtManyHash rehasher; // Used only for canonical mode to rehash the value
 
-    hll::hll_t hll(HLL_SIZE);
+    std::vector<hll::hll_t> sketches(omp_get_max_threads(), hll::hll_t(HLL_SIZE));
 
-    auto cardinality_step = [&](const SeqInfo& seq_info) {
+    auto cardinality_step = [&](const kebab::SeqBatch& batch) {
         thread_local static kebab::NtHash hasher(kmer_size, use_build_rev_comp(kmer_mode));
+        hll::hll_t& sketch = sketches[omp_get_thread_num()];
+
+        // Sized up front for every k-mer of the batch, the spool takes it over whole
+        std::vector<uint64_t> spooled;
+        if (spool) {
+            size_t num_hashes = 0;
+            for (const SeqInfo& seq_info : batch) {
+                num_hashes += (seq_info.seq_len >= kmer_size) ? seq_info.seq_len - kmer_size + 1 : 0;
+            }
+            spooled.reserve((kmer_mode == KmerMode::BOTH_STRANDS) ? 2 * num_hashes : num_hashes);
+        }
+        auto keep = [&](uint64_t hash) {
+            if (spool) {
+                spooled.push_back(hash);
+            }
+        };
 
-        auto add_kmer = [&]() {
+        for (const SeqInfo& seq_info : batch) {
+            const char* seq_content = seq_info.seq_content;
+            const size_t seq_len = static_cast<size_t>(seq_info.seq_len);
             switch (kmer_mode) {
                 case KmerMode::FORWARD_ONLY:
-                    hll.add(hasher.hash());
+                    hasher.for_each_kmer<false, false>(seq_content, seq_len, [&](size_t, uint64_t hash, uint64_t) {
+                        sketch.add(hash);
+                        keep(hash);
+                    });
                     break;
                 case KmerMode::BOTH_STRANDS:
-                    hll.add(hasher.hash());
-                    hll.add(hasher.hash_rc());
+                    hasher.for_each_kmer<false, true>(seq_content, seq_len, [&](size_t, uint64_t hash, uint64_t hash_rc) {
+                        sketch.add(hash);
+                        sketch.add(hash_rc);
+                        keep(hash);
+                        keep(hash_rc);
+                    });
                     break;
                 case KmerMode::CANONICAL_ONLY:
                     // hashes again, since canonical biases estimate lower
-                    hll.add(rehasher(hasher.hash_canonical()));
+                    hasher.for_each_kmer<true, false>(seq_content, seq_len, [&](size_t, uint64_t hash, uint64_t) {
+                        sketch.add(rehasher(hash));
+                        keep(hash);
+                    });
                     break;
             }
-        };
-
-        hasher.set_sequence(seq_info.seq_content, seq_info.seq_len);
-        add_kmer();
-        for (size_t i = 1; i < static_cast<size_t>(seq_info.seq_len) - kmer_size + 1; ++i) {
-            hasher.unsafe_roll();
-            add_kmer();
+        }
+        if (spool) {
+            spool->add(std::move(spooled));
         }
 
         #pragma omp critical(update_progress)
         {
-            bytes_processed += bytes_read(seq_info);
             std::cerr << "\rEstimating Cardinality: " 
                     << std::fixed << std::setprecision(2) << std::setw(6) 
-                    << (bytes_processed * 100.0 / file_size) << "%" << std::flush;
+                    << input_progress(*file.input) << "%" << std::flush;
         }
+        stats.worker(omp_get_thread_num()).lap(kebab::Phase::SKETCH);
     };
 
-    process_sequences(seq, threads, cardinality_step);
+    // Chunks share k - 1 bases, so each k-mer is still sketched once
+    process_sequence_batches(file, threads, cardinality_step, false, nullptr, &stats, kmer_size - 1);
     const auto end_time = std::chrono::steady_clock::now();
 
     const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);   
     std::cerr << "\rEstimating Cardinality: 100.00% [" << std::fixed << std::setprecision(2) 
               << (elapsed.count() / 1000.0) << "s]" << std::endl;
 
-    // TODO: ADD STATS
-    std::cerr << "\tEstimate: " << static_cast<uint64_t>(std::ceil(hll.report())) << std::endl;
-    std::cerr << "\tError Bounds: " << hll.est_err() << std::endl;
-
-    kseq_destroy(seq);
-    fclose(fp);
+    close_seq_file(file);
+    if (spool && spool->failed()) {
+        error_exit(spool->get_error());
+    }
 
-    return static_cast<uint64_t>(std::ceil(hll.report()));
+    hll = std::move(sketches[0]);
+    for (size_t i = 1; i < sketches.size(); ++i) {
+        hll += sketches[i];
+    }
 }
 
 /* =============================== BUILD =============================== */
@@ -164,6 +368,13 @@ struct BuildParams {
     uint64_t expected_kmers = DEFAULT_EXPECTED_KMERS;
     uint16_t threads = DEFAULT_BUILD_THREADS;
     FilterSizeMode filter_size_mode = DEFAULT_FILTER_SIZE_MODE;
+    FilterType filter_type = DEFAULT_FILTER_TYPE;
+    bool single_pass = DEFAULT_SINGLE_PASS;
+    uint64_t spool_memory = DEFAULT_SPOOL_MEMORY; // MB
+    bool sketch_cache = DEFAULT_SKETCH_CACHE;
+    std::string stats_file; // JSON run statistics, if wanted
+    std::string append_index; // existing index to insert into, instead of sizing a new one
+    double max_fp_rate = DEFAULT_MAX_FP_RATE; // appending only
 
     void validate(bool no_filter_rounding) {
         if (output_prefix.empty()) {
@@ -179,97 +390,369 @@ struct BuildParams {
         if (no_filter_rounding) {
             filter_size_mode = FilterSizeMode::EXACT;
         }
+        if (!append_index.empty()) {
+            if (std::filesystem::path(append_index).extension() != KEBAB_FILE_SUFFIX) {
+                append_index += KEBAB_FILE_SUFFIX;
+            }
+            if (!std::filesystem::exists(append_index)) {
+                error_exit("Index file does not exist: " + append_index);
+            }
+        }
     }
 };
 
-struct SavedOptions {
-    FilterSizeMode filter_size_mode = DEFAULT_FILTER_SIZE_MODE;
-};
+// Inserts the hashes kept by a single pass build's estimation pass, threads claim whole chunks
+template<typename Index>
+void replay_spool(Index& index, const kebab::HashSpool& spool, std::vector<typename Index::BuildContext>& contexts, kebab::RunStats& stats) {
+    std::atomic<size_t> next_chunk(0);
+    std::atomic<size_t> chunks_done(0);
+    std::string error;
 
-void save_options(std::ostream& out, const BuildParams& params) {
-    out.write(reinterpret_cast<const char*>(&params.filter_size_mode), sizeof(params.filter_size_mode));
+    #pragma omp parallel
+    {
+        std::vector<uint64_t> buffer;
+        size_t i;
+        while ((i = next_chunk.fetch_add(1)) < spool.get_num_chunks()) {
+            try {
+                size_t count;
+                const uint64_t* hashes = spool.get_chunk(i, buffer, count);
+                index.add_hashes(hashes, count, contexts[omp_get_thread_num()]);
+            } catch (const std::runtime_error& e) {
+                #pragma omp critical(spool_error)
+                error = e.what();
+                break;
+            }
+
+            const size_t done = ++chunks_done;
+            #pragma omp critical(update_progress)
+            {
+                std::cerr << "\rIndexing: " 
+                        << std::fixed << std::setprecision(2) << std::setw(6) 
+                        << done * 100.0 / spool.get_num_chunks() << "%" << std::flush;
+            }
+            stats.worker(omp_get_thread_num()).lap(kebab::Phase::INSERT);
+        }
+    }
+
+    if (!error.empty()) {
+        error_exit(error);
+    }
 }
 
-void load_options(std::istream& in, SavedOptions& options) {
-    in.read(reinterpret_cast<char*>(&options.filter_size_mode), sizeof(options.filter_size_mode));
+// Reads the input and inserts its k-mers into each thread's context
+template<typename Index>
+void insert_sequences(Index& index, const BuildParams& params, std::vector<typename Index::BuildContext>& contexts, kebab::RunStats& stats) {
+    SeqFile file;
+    open_seq_file(params.fasta_file, params.threads, file);
+
+    auto add_sequence_step = [&](const SeqInfo& seq_info) {
+        index.add_sequence(seq_info.seq_content, seq_info.seq_len, contexts[omp_get_thread_num()]);
+
+        #pragma omp critical(update_progress)
+        {
+            std::cerr << "\rIndexing: " 
+                    << std::fixed << std::setprecision(2) << std::setw(6) 
+                    << input_progress(*file.input) << "%" << std::flush;
+        }
+        stats.worker(omp_get_thread_num()).lap(kebab::Phase::INSERT);
+    };
+
+    process_sequences(file, params.threads, add_sequence_step, &stats, index.get_k() - 1);
+    close_seq_file(file);
 }
 
 template<typename Index>
 void populate_index(const BuildParams& params) {
+    kebab::RunStats stats(!params.stats_file.empty(), omp_get_max_threads());
+
     uint64_t num_expected_kmers = params.expected_kmers;
+    // A single pass build keeps the estimation pass's hashes, so the input is only read once
+    std::unique_ptr<kebab::HashSpool> spool;
     if (num_expected_kmers == 0) {
-        num_expected_kmers = card_estimate(params.fasta_file, params.kmer_size, params.kmer_mode, params.threads);
+        hll::hll_t hll(HLL_SIZE);
+        // A saved sketch already gives the estimate, leaving a single read of the input regardless
+        if (params.sketch_cache && kebab::load_sketch(params.fasta_file, params.kmer_size, params.kmer_mode, hll)) {
+            note("Using saved sketch " + kebab::sketch_path(params.fasta_file, params.kmer_size, params.kmer_mode));
+        }
+        else {
+            if (params.single_pass) {
+                spool = std::make_unique<kebab::HashSpool>(params.spool_memory * 1024 * 1024, params.output_prefix + SPOOL_FILE_SUFFIX);
+            }
+            card_estimate(params.fasta_file, params.kmer_size, params.kmer_mode, params.threads, hll, spool.get(), stats);
+            if (params.sketch_cache) {
+                try {
+                    kebab::save_sketch(params.fasta_file, params.kmer_size, params.kmer_mode, hll);
+                } catch (const std::runtime_error& e) {
+                    note(std::string(e.what()) + ", estimation will run again next build");
+                }
+            }
+        }
+
+        // TODO: ADD STATS
+        num_expected_kmers = static_cast<uint64_t>(std::ceil(hll.report()));
+        std::cerr << "\tEstimate: " << num_expected_kmers << std::endl;
+        std::cerr << "\tError Bounds: " << hll.est_err() << std::endl;
     }
 
     const auto start_time = std::chrono::steady_clock::now();
 
     Index index(params.kmer_size, num_expected_kmers, params.fp_rate, params.hash_funcs, params.kmer_mode, params.filter_size_mode);
 
-    FILE* fp;
-    kseq_t* seq = open_fasta(params.fasta_file, &fp);
+    // Each thread buffers its insertions by filter region rather than updating the filter atomically
+    std::vector<typename Index::BuildContext> contexts(omp_get_max_threads());
 
-    // For progress
-    size_t file_size = std::filesystem::file_size(params.fasta_file);
-    size_t bytes_processed = 0;
+    stats.restart();
+    if (spool) {
+        replay_spool(index, *spool, contexts, stats);
+    }
+    else {
+        // Counted again as the input is read again
+        stats.reader().reads = 0;
+        stats.reader().bases = 0;
+        insert_sequences(index, params, contexts, stats);
+    }
+    index.finish_build(contexts);
 
-    auto add_sequence_step = [&](const SeqInfo& seq_info) {
-        index.add_sequence(seq_info.seq_content, seq_info.seq_len);
+    const auto end_time = std::chrono::steady_clock::now();
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
+    std::cerr << "\rIndexing: 100.00% [" << std::fixed << std::setprecision(2) 
+              << (elapsed.count() / 1000.0) << "s]" << std::endl;
+    if (spool && spool->get_spilled_bytes() > 0) {
+        note("Spooled " + std::to_string(spool->get_spilled_bytes() / (1024 * 1024)) + "MB of hashes to disk, raise --spool-memory to keep them in memory");
+    }
 
-        #pragma omp critical(update_progress)
-        {
-            bytes_processed += bytes_read(seq_info);
-            std::cerr << "\rIndexing: " 
-                    << std::fixed << std::setprecision(2) << std::setw(6) 
-                    << (bytes_processed * 100.0 / file_size) << "%" << std::flush;
+    std::cerr << index.get_stats() << std::endl;
+
+    write_index(index, params.output_prefix, params.filter_size_mode, params.filter_type);
+
+    if (!params.stats_file.empty()) {
+        for (size_t i = 0; i < contexts.size(); ++i) {
+            stats.worker(i).kmers = contexts[i].get_kmers_added();
         }
-    };
+        stats.set("expected_kmers", num_expected_kmers);
+        stats.set("spilled_bytes", spool ? spool->get_spilled_bytes() : 0);
+        try {
+            stats.write_json(params.stats_file, "build");
+        } catch (const std::runtime_error& e) {
+            error_exit(e.what());
+        }
+    }
+}
+
+// Inserts into an index that is already sized, so no estimate is needed but its false positive rate grows
+template<typename Index>
+void append_index(const BuildParams& params, std::ifstream& index_stream, const kebab::IndexHeader& header) {
+    kebab::RunStats stats(!params.stats_file.empty(), omp_get_max_threads());
 
-    process_sequences(seq, params.threads, add_sequence_step);
+    // Loaded rather than mapped, as the filter is written to
+    Index index(index_stream, header.version);
+    index_stream.close();
+    const double initial_fp_rate = index.get_fp_rate();
+
+    const auto start_time = std::chrono::steady_clock::now();
+
+    std::vector<typename Index::BuildContext> contexts(omp_get_max_threads());
+
+    stats.restart();
+    insert_sequences(index, params, contexts, stats);
+    index.finish_build(contexts);
 
     const auto end_time = std::chrono::steady_clock::now();
     const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - start_time);
     std::cerr << "\rIndexing: 100.00% [" << std::fixed << std::setprecision(2) 
               << (elapsed.count() / 1000.0) << "s]" << std::endl;
 
-    kseq_destroy(seq);
-    fclose(fp);
-
     std::cerr << index.get_stats() << std::endl;
+    check_fp_rate(index.get_fp_rate(), params.max_fp_rate, "rebuild the index from all of its sequences to restore it");
+
+    write_index(index, params.output_prefix, header.filter_size_mode, header.filter_type);
 
-    std::ofstream out(params.output_prefix + KEBAB_FILE_SUFFIX);
-    save_options(out, params);
-    index.save(out);
+    if (!params.stats_file.empty()) {
+        for (size_t i = 0; i < contexts.size(); ++i) {
+            stats.worker(i).kmers = contexts[i].get_kmers_added();
+        }
+        stats.set("initial_fp_rate", initial_fp_rate);
+        stats.set("fp_rate", index.get_fp_rate());
+        try {
+            stats.write_json(params.stats_file, "build");
+        } catch (const std::runtime_error& e) {
+            error_exit(e.what());
+        }
+    }
 }
 
 void build_index(const BuildParams& params) {
+    if (!params.append_index.empty()) {
+        if (params.max_fp_rate <= 0 || params.max_fp_rate >= 1) {
+            error_exit("Maximum false positive rate (" + std::to_string(params.max_fp_rate) + ") must be between 0 and 1");
+        }
+        std::ifstream index_stream(params.append_index);
+        const kebab::IndexHeader header = read_header(index_stream);
+        kebab::visit_index_type(header.filter_type, header.filter_size_mode, [&](auto tag) {
+            append_index<typename decltype(tag)::type>(params, index_stream, header);
+        });
+        return;
+    }
     if (params.fp_rate <= 0 || params.fp_rate >= 1) {
         error_exit("Desired false positive rate (" + std::to_string(params.fp_rate) + ") must be between 0 and 1");
     }
     if (params.hash_funcs > std::size(SEEDS)) {
         error_exit("Number of hashes (" + std::to_string(params.hash_funcs) + ") must be less than the number of seeds (" + std::to_string(std::size(SEEDS)) + ")");
     }
+    if (params.filter_type == FilterType::BLOCKED && params.hash_funcs >= std::size(SEEDS)) {
+        error_exit("Number of hashes (" + std::to_string(params.hash_funcs) + ") must be at most " + std::to_string(std::size(SEEDS) - 1) + " for blocked filters");
+    }
+
+    kebab::visit_index_type(params.filter_type, params.filter_size_mode, [&](auto tag) {
+        populate_index<typename decltype(tag)::type>(params);
+    });
+}
+
+/* =============================== MERGE =============================== */
+
+struct MergeParams {
+    std::vector<std::string> index_files;
+    std::string output_prefix;
+    double max_fp_rate = DEFAULT_MAX_FP_RATE;
+
+    void validate() {
+        std::filesystem::path output_path(output_prefix);
+        if (output_path.extension() == KEBAB_FILE_SUFFIX) {
+            output_prefix = output_path.stem();
+        }
+        for (std::string& index_file : index_files) {
+            if (std::filesystem::path(index_file).extension() != KEBAB_FILE_SUFFIX) {
+                index_file += KEBAB_FILE_SUFFIX;
+            }
+            if (!std::filesystem::exists(index_file)) {
+                error_exit("Index file does not exist: " + index_file);
+            }
+        }
+        if (index_files.size() < 2) {
+            error_exit("At least two indexes are needed to merge");
+        }
+        if (max_fp_rate <= 0 || max_fp_rate >= 1) {
+            error_exit("Maximum false positive rate (" + std::to_string(max_fp_rate) + ") must be between 0 and 1");
+        }
+    }
+};
+
+// ORs every index into the first, which is loaded as it is written to while the rest are only read, so are mapped
+template<typename Index>
+void merge_into(const MergeParams& params, std::ifstream& index_stream, const kebab::IndexHeader& header) {
+    Index index(index_stream, header.version);
+    index_stream.close();
+
+    for (size_t i = 1; i < params.index_files.size(); ++i) {
+        const std::string& index_file = params.index_files[i];
+        std::ifstream other_stream(index_file);
+        const kebab::IndexHeader other_header = read_header(other_stream);
+        // The header picks the filter's layout and hash, so these must agree before the filter is read as one
+        if (other_header.filter_type != header.filter_type || use_shift_filter(other_header.filter_size_mode) != use_shift_filter(header.filter_size_mode)) {
+            error_exit("Index " + index_file + " has a different filter type or size mode than " + params.index_files[0]);
+        }
+        const Index other(other_stream, other_header.version, map_index(index_file, other_header, DEFAULT_POPULATE, DEFAULT_HUGE_PAGES));
+        try {
+            index.merge(other);
+        } catch (const std::invalid_argument& e) {
+            error_exit("Cannot merge " + index_file + " into " + params.index_files[0] + ": " + e.what());
+        }
+    }
+
+    std::cerr << index.get_stats() << std::endl;
+    check_fp_rate(index.get_fp_rate(), params.max_fp_rate, "rebuild the index from all of its sequences to restore it");
+
+    write_index(index, params.output_prefix, header.filter_size_mode, header.filter_type);
+}
+
+void merge_indexes(const MergeParams& params) {
+    std::ifstream index_stream(params.index_files[0]);
+    const kebab::IndexHeader header = read_header(index_stream);
+
+    kebab::visit_index_type(header.filter_type, header.filter_size_mode, [&](auto tag) {
+        merge_into<typename decltype(tag)::type>(params, index_stream, header);
+    });
+}
+
+/* =============================== FOLD =============================== */
+
+struct FoldParams {
+    std::string index_file;
+    std::string output_prefix;
+    size_t folds = DEFAULT_FOLDS;
+    uint64_t max_size = 0; // KB, folds until the filter fits instead of a fixed number of times
+    double max_fp_rate = DEFAULT_MAX_FP_RATE;
+
+    void validate() {
+        std::filesystem::path index_path(index_file);
+        if (index_path.extension() != KEBAB_FILE_SUFFIX) {
+            index_file += KEBAB_FILE_SUFFIX;
+        }
+        if (!std::filesystem::exists(index_file)) {
+            error_exit("Index file does not exist: " + index_file);
+        }
+        std::filesystem::path output_path(output_prefix);
+        if (output_path.extension() == KEBAB_FILE_SUFFIX) {
+            output_prefix = output_path.stem();
+        }
+        if (max_fp_rate <= 0 || max_fp_rate >= 1) {
+            error_exit("Maximum false positive rate (" + std::to_string(max_fp_rate) + ") must be between 0 and 1");
+        }
+    }
+};
+
+// Folding reads the whole filter once, so the index is mapped rather than copied before being halved
+template<typename Index>
+void fold_into(const FoldParams& params, std::ifstream& index_stream, const kebab::IndexHeader& header, const std::shared_ptr<const kebab::MappedFile>& mapping) {
+    Index index(index_stream, header.version, mapping);
+    fold_index(index, params.folds, params.max_size);
+
+    std::cerr << index.get_stats() << std::endl;
+    check_fp_rate(index.get_fp_rate(), params.max_fp_rate, "fold fewer times");
+
+    write_index(index, params.output_prefix, header.filter_size_mode, header.filter_type);
+}
 
-    if (use_shift_filter(params.filter_size_mode)) {
-        populate_index<kebab::KebabIndex<kebab::ShiftFilter>>(params);
-    } else {
-        populate_index<kebab::KebabIndex<kebab::ModFilter>>(params);
+void fold_filter(const FoldParams& params) {
+    std::ifstream index_stream(params.index_file);
+    const kebab::IndexHeader header = read_header(index_stream);
+    if (!use_shift_filter(header.filter_size_mode)) {
+        error_exit("Only power of two sized filters can be folded, " + params.index_file + " was built with --no-rounding");
     }
+    const std::shared_ptr<const kebab::MappedFile> mapping = map_index(params.index_file, header, DEFAULT_POPULATE, DEFAULT_HUGE_PAGES);
+
+    kebab::visit_index_type(header.filter_type, header.filter_size_mode, [&](auto tag) {
+        fold_into<typename decltype(tag)::type>(params, index_stream, header, mapping);
+    });
 }
 
 /* =============================== SCAN =============================== */
 
 struct ScanParams {
     std::string fasta_file;
+    std::string mate_file; // second file of paired-end reads, if any
     std::string index_file;
     std::string output_file;
-    uint64_t min_mem_length = DEFAULT_MIN_MEM_LENGTH;
+    std::vector<uint64_t> min_mem_lengths = {DEFAULT_MIN_MEM_LENGTH}; // one output each
     uint16_t top_t = DEFAULT_TOP_T;
     bool sort_fragments = DEFAULT_SORT_FRAGMENTS;
     bool remove_overlaps = DEFAULT_REMOVE_OVERLAPS;
     bool prefetch = DEFAULT_PREFETCH;
+    bool skip_ahead = DEFAULT_SKIP_AHEAD;
+    size_t prefetch_distance = PREFETCH_DISTANCE;
+    bool use_tuning = DEFAULT_USE_TUNING;
+    bool mmap = DEFAULT_MMAP;
+    bool populate = DEFAULT_POPULATE;
+    bool huge_pages = DEFAULT_HUGE_PAGES;
+    bool ordered = DEFAULT_ORDERED_OUTPUT;
+    bool keep_qualities = DEFAULT_KEEP_QUALITIES;
+    bool binary = DEFAULT_BINARY_OUTPUT;
+    bool pack_sequences = DEFAULT_PACK_SEQUENCES;
     uint16_t threads = DEFAULT_SCAN_THREADS;
+    size_t folds = DEFAULT_SCAN_FOLDS;
+    std::string stats_file; // JSON run statistics, if wanted
 
-    void validate(bool no_prefetch, bool threads_set) {
+    void validate(bool no_prefetch, bool no_mmap, bool threads_set) {
         if (output_file.empty()) {
             error_exit("No output file specified");
         }
@@ -286,10 +769,27 @@ struct ScanParams {
                 error_exit("Index file does not exist: " + index_file);
             }
         }
+        std::sort(min_mem_lengths.begin(), min_mem_lengths.end());
+        min_mem_lengths.erase(std::unique(min_mem_lengths.begin(), min_mem_lengths.end()), min_mem_lengths.end());
         if (no_prefetch) {
             prefetch = false;
             threads = (threads_set) ? threads : omp_get_max_threads();
         }
+        if (no_mmap) {
+            mmap = false;
+            if (populate || huge_pages) {
+                warning("--populate and --huge-pages only apply to memory-mapped indexes, ignoring with --no-mmap");
+                populate = false;
+                huge_pages = false;
+            }
+        }
+        if (binary && keep_qualities) {
+            error_exit("--keep-qualities only applies to FASTA/FASTQ output, not --binary");
+        }
+        // Add .kbf suffix if not present
+        if (binary && std::filesystem::path(output_file).extension() != FRAGMENT_FILE_SUFFIX) {
+            output_file += FRAGMENT_FILE_SUFFIX;
+        }
         if (top_t) {
             if (!sort_fragments) {
                 note("top-t filtering requires sorting fragments (-s/--sort), enabling automatically...");
@@ -304,67 +804,552 @@ struct ScanParams {
             warning("Downstream applications for sorted fragments may be affected by removing overlaps (-r/--remove-overlaps)");
         }
     }
+
+    // Settings saved by kebab tune fill in whatever wasn't given on the command line
+    void apply_tuning(bool no_prefetch, bool threads_set, bool distance_set) {
+        kebab::TuneResult tuned;
+        if (!use_tuning || (threads_set && (no_prefetch || distance_set)) || !kebab::load_tune(index_file, tuned)) {
+            return;
+        }
+        note("Using settings tuned for this index (" + kebab::tune_path(index_file) + ")");
+        if (!no_prefetch && !distance_set) {
+            prefetch = tuned.prefetch_distance > 0;
+            prefetch_distance = prefetch ? tuned.prefetch_distance : PREFETCH_DISTANCE;
+        }
+        if (!threads_set) {
+            threads = tuned.threads;
+        }
+    }
 };
 
+// Writes a fragment as a FASTA record, or FASTQ when given its qualities. Ranges are 1-based inclusive.
+void append_fragment_record(kebab::OutputBuffer& buffer, const char* name, size_t name_len, uint8_t mate, const kebab::Fragment& fragment, const char* seq, const char* qual) {
+    buffer.append(qual ? '@' : '>');
+    buffer.append(name, name_len);
+    if (mate) {
+        buffer.append('/');
+        buffer.append(static_cast<char>('0' + mate));
+    }
+    buffer.append(':');
+    buffer.append_uint(fragment.start + 1);
+    buffer.append('-');
+    buffer.append_uint(fragment.start + fragment.length);
+    buffer.append('\n');
+    buffer.append(seq, fragment.length);
+    buffer.append('\n');
+    if (qual) {
+        buffer.append("+\n");
+        buffer.append(qual, fragment.length);
+        buffer.append('\n');
+    }
+}
+
+// One output of a scan, per minimum MEM length
+struct ScanOutput {
+    uint64_t min_mem_length;
+    std::string path;
+    FILE* out;
+    std::unique_ptr<kebab::OutputWriter> writer;
+    bool written = false; // every buffer reached the file
+};
+
+// With several minimum MEM lengths, OUTPUT.EXT becomes OUTPUT.l[L].EXT for each
+std::string scan_output_path(const std::string& output_file, uint64_t min_mem_length, bool several) {
+    if (!several) {
+        return output_file;
+    }
+    std::filesystem::path path(output_file);
+    const std::string extension = path.extension().string();
+    path.replace_extension(".l" + std::to_string(min_mem_length) + extension);
+    return path.string();
+}
+
 template<typename Index>
-void filter_reads(const ScanParams& params, std::ifstream& index_stream) {
-    Index index(index_stream);
-    if (params.min_mem_length <= index.get_k()) {
-        error_exit("min_mem_length (" + std::to_string(params.min_mem_length) + ") must be greater than k (" + std::to_string(index.get_k()) + ")");
+void filter_reads(const ScanParams& params, std::ifstream& index_stream, const kebab::IndexHeader& header, const std::shared_ptr<const kebab::MappedFile>& mapping) {
+    Index index(index_stream, header.version, mapping);
+    if (params.folds) {
+        fold_index(index, params.folds, 0);
+    }
+    index.set_prefetch_distance(params.prefetch_distance);
+    // Ascending, so the first is the one scanned with
+    const uint64_t min_mem_length = params.min_mem_lengths.front();
+    if (min_mem_length <= index.get_k()) {
+        error_exit("min_mem_length (" + std::to_string(min_mem_length) + ") must be greater than k (" + std::to_string(index.get_k()) + ")");
     }
 
-    FILE* fp;
-    kseq_t* seq = open_fasta(params.fasta_file, &fp);
+    SeqFile file;
+    open_seq_file(params.fasta_file, params.threads, file);
+    SeqFile mate_file;
+    if (!params.mate_file.empty()) {
+        open_seq_file(params.mate_file, params.threads, mate_file);
+    }
 
-    // For maximum performance, use system buffer size
-    FILE* out = fopen(params.output_file.c_str(), "w");
-    int fd = fileno(out);
-    long long buffer_size = fpathconf(fd, _PC_REC_XFER_ALIGN);
-    if (buffer_size <= 0) {
-        buffer_size = DEFAULT_BUFFER_SIZE;
+    // Every read is scanned once, and each output's fragments are derived from those of the smallest length
+    const bool several = params.min_mem_lengths.size() > 1;
+    std::vector<ScanOutput> outputs(params.min_mem_lengths.size());
+    kebab::RunStats stats(!params.stats_file.empty(), omp_get_max_threads(), outputs.size());
+    for (size_t o = 0; o < outputs.size(); ++o) {
+        outputs[o].path = scan_output_path(params.output_file, params.min_mem_lengths[o], several);
+        outputs[o].min_mem_length = params.min_mem_lengths[o];
+        const std::string& path = outputs[o].path;
+        outputs[o].out = fopen(path.c_str(), "w");
+        if (!outputs[o].out) {
+            error_exit("Problem opening output file (" + path + ")");
+        }
+
+        // For maximum performance, use system buffer size
+        int fd = fileno(outputs[o].out);
+        long long buffer_size = fpathconf(fd, _PC_REC_XFER_ALIGN);
+        if (buffer_size <= 0) {
+            buffer_size = DEFAULT_BUFFER_SIZE;
+        }
+        setvbuf(outputs[o].out, nullptr, _IOFBF, buffer_size);
+        if (params.binary) {
+            try {
+                kebab::write_fragment_file_header(outputs[o].out, params.pack_sequences);
+            } catch (const std::runtime_error& e) {
+                error_exit(std::string(e.what()) + " (" + path + ")");
+            }
+        }
+
+        // Workers format whole batches into buffers, a writer thread owns the file
+        outputs[o].writer = std::make_unique<kebab::OutputWriter>(outputs[o].out, static_cast<size_t>(params.threads) * SEQ_BATCHES_PER_THREAD + 1, params.ordered);
     }
-    setvbuf(out, nullptr, _IOFBF, buffer_size);
 
-    auto filter_read_step = [&](const SeqInfo& seq_info) {
-        thread_local static std::vector<kebab::Fragment> fragments;
+    // Chunks of split records scanned so far, by the record's first base. The worker scanning a record's last
+    // outstanding chunk joins their fragments and writes the record, where that chunk is in its batch.
+    struct SplitScan {
+        std::vector<kebab::ChunkFragments> chunks;
+        uint32_t scanned = 0;
+    };
+    std::mutex split_mutex;
+    std::unordered_map<const char*, SplitScan> split_scans;
+
+    auto filter_batch_step = [&](const kebab::SeqBatch& batch) {
+        // Reused across reads and batches, so steady state scanning doesn't allocate
+        thread_local static typename Index::ScanContext context;
+        thread_local static std::vector<kebab::Sequence> reads;
+        thread_local static std::vector<kebab::Fragment> stitched;
+        thread_local static std::vector<kebab::Fragment> joined;
+        thread_local static std::vector<kebab::Fragment> selected;
+        thread_local static std::vector<kebab::OutputBuffer*> buffers;
+        thread_local static std::vector<std::optional<kebab::FragmentBlockWriter>> blocks;
+        kebab::ThreadStats& thread_stats = stats.worker(omp_get_thread_num());
+
+        // Every writer is acquired in the same order, so workers never wait on each other in a cycle
+        buffers.resize(outputs.size());
+        blocks.resize(outputs.size());
+        for (size_t o = 0; o < outputs.size(); ++o) {
+            buffers[o] = &outputs[o].writer->acquire(batch.id);
+            // Binary output writes a block for every batch, even one without fragments, so readers can restore input order
+            if (params.binary) {
+                blocks[o].emplace(buffers[o]->bytes(), batch.id, batch.first_record, params.pack_sequences);
+            }
+        }
+        thread_stats.lap(kebab::Phase::OUTPUT_WAIT);
+
+        // The whole batch is scanned as one stream, so prefetching never waits on a read boundary.
+        // Overlaps are only merged per output when there are several, as merging depends on which fragments are kept.
+        // Top-t fragments come out sorted, and those of a larger length are a prefix of the smallest length's.
+        // Chunks are scanned on their own below, they stand in the batch as empty reads to keep its offsets aligned
+        reads.clear();
+        for (size_t read_index = 0; read_index < batch.size(); ++read_index) {
+            const SeqInfo& seq_info = batch[read_index];
+            reads.push_back({seq_info.seq_content, seq_info.is_chunk() ? 0 : static_cast<size_t>(seq_info.seq_len)});
+        }
+        index.scan_batch(reads.data(), reads.size(), context, min_mem_length, params.remove_overlaps && !several, params.prefetch, params.top_t, params.skip_ahead);
+        thread_stats.kmers += context.get_kmers_queried();
+        thread_stats.kmer_misses += context.get_kmer_misses();
+        thread_stats.lap(kebab::Phase::LOOKUP);
+
+        const std::vector<size_t>& offsets = context.get_batch_offsets();
+        for (size_t read_index = 0; read_index < batch.size(); ++read_index) {
+            const SeqInfo& seq_info = batch[read_index];
+            kebab::Fragment* read_fragments = context.get_batch_fragments().data() + offsets[read_index];
+            size_t read_count = offsets[read_index + 1] - offsets[read_index];
+
+            if (seq_info.is_chunk()) {
+                // Chunks keep every fragment and report their cut runs, never skipping ahead, so they can be joined exactly
+                kebab::ChunkFragments chunk;
+                index.scan_read(seq_info.seq_content, seq_info.seq_len, context, min_mem_length, false, params.prefetch);
+                chunk.offset = seq_info.seq_offset;
+                chunk.len = seq_info.seq_len;
+                chunk.head_end = context.get_head_end();
+                chunk.tail_start = context.get_tail_start();
+                chunk.fragments = context.get_fragments();
+                thread_stats.kmers += context.get_kmers_queried();
+                thread_stats.kmer_misses += context.get_kmer_misses();
+                thread_stats.lap(kebab::Phase::LOOKUP);
+
+                SplitScan split;
+                {
+                    std::lock_guard<std::mutex> lock(split_mutex);
+                    const char* record = seq_info.seq_content - seq_info.seq_offset;
+                    SplitScan& pending = split_scans[record];
+                    pending.chunks.resize(seq_info.num_chunks);
+                    pending.chunks[seq_info.chunk] = std::move(chunk);
+                    if (++pending.scanned < seq_info.num_chunks) {
+                        continue;
+                    }
+                    split = std::move(pending);
+                    split_scans.erase(record);
+                }
 
-        fragments.clear();
-        fragments = index.scan_read(seq_info.seq_content, seq_info.seq_len, params.min_mem_length, params.remove_overlaps, params.prefetch);
-        
-        if (params.sort_fragments) {
-            std::sort(fragments.begin(), fragments.end());
+                // As scanning the record whole would have left it
+                kebab::stitch_fragments(split.chunks, min_mem_length, stitched);
+                if (params.remove_overlaps && !several) {
+                    kebab::select_fragments(stitched.data(), stitched.size(), min_mem_length, true, joined);
+                    stitched.swap(joined);
+                }
+                if (params.top_t) {
+                    std::sort(stitched.begin(), stitched.end());
+                    stitched.resize(std::min<size_t>(stitched.size(), params.top_t));
+                }
+                read_fragments = stitched.data();
+                read_count = stitched.size();
+            }
+            // A chunk's fragments are written with its whole record
+            const char* record_seq = seq_info.seq_content - seq_info.seq_offset;
+            const char* record_qual = seq_info.seq_qual ? seq_info.seq_qual - seq_info.seq_offset : nullptr;
+
+            for (size_t o = 0; o < outputs.size(); ++o) {
+                kebab::Fragment* fragments = read_fragments;
+                size_t frags_to_write = read_count;
+                if (several) {
+                    kebab::select_fragments(read_fragments, read_count, outputs[o].min_mem_length, params.remove_overlaps, selected);
+                    fragments = selected.data();
+                    frags_to_write = selected.size();
+                }
+
+                if (params.sort_fragments && !params.top_t) {
+                    std::sort(fragments, fragments + frags_to_write);
+                }
+
+                kebab::FragmentCounts& counts = thread_stats.outputs[o];
+                counts.fragments += frags_to_write;
+                for (size_t i = 0; i < frags_to_write; ++i) {
+                    counts.bases += fragments[i].length;
+                }
+                thread_stats.lap(kebab::Phase::SELECT);
+
+                if (params.binary) {
+                    blocks[o]->add(read_index, seq_info.seq_name, seq_info.seq_name_len, seq_info.mate, record_seq, fragments, frags_to_write);
+                }
+                else {
+                    for (size_t i = 0; i < frags_to_write; ++i) {
+                        const kebab::Fragment& fragment = fragments[i];
+                        append_fragment_record(*buffers[o], seq_info.seq_name, seq_info.seq_name_len, seq_info.mate, fragment, record_seq + fragment.start,
+                                               params.keep_qualities ? record_qual + fragment.start : nullptr);
+                    }
+                }
+                thread_stats.lap(kebab::Phase::FORMAT);
+            }
         }
-        
-        #pragma omp critical(write_fragments)
-        {
-            size_t frags_to_write = (params.top_t) ? std::min(static_cast<size_t>(params.top_t), fragments.size()) : fragments.size();
-            for (size_t i = 0; i < frags_to_write; ++i) {
-                const auto& fragment = fragments[i];
-                // use 1-based inclusive
-                fprintf(out, ">%s:%zu-%zu\n", seq_info.seq_name, fragment.start + 1, fragment.start + fragment.length);
-                fwrite(seq_info.seq_content + fragment.start, 1, fragment.length, out);
-                fputc('\n', out);
+
+        for (size_t o = 0; o < outputs.size(); ++o) {
+            if (params.binary) {
+                blocks[o]->finish();
             }
+            outputs[o].writer->submit(*buffers[o]);
         }
     };
 
-    process_sequences(seq, params.threads, filter_read_step);
+    process_sequence_batches(file, params.threads, filter_batch_step, params.keep_qualities, params.mate_file.empty() ? nullptr : &mate_file, &stats, index.get_k() - 1);
+    for (ScanOutput& output : outputs) {
+        output.written = output.writer->finish();
+        stats.writer().phase_nanos[static_cast<size_t>(kebab::Phase::WRITE)] += output.writer->get_write_nanos();
+    }
+
+    close_seq_file(file);
+    if (!params.mate_file.empty()) {
+        close_seq_file(mate_file);
+    }
+    // Every writer has stopped, so failures are only reported once nothing is still writing
+    for (ScanOutput& output : outputs) {
+        const bool written = output.written && !ferror(output.out);
+        if (fclose(output.out) != 0 || !written) {
+            error_exit("Problem writing output file (" + output.path + ")");
+        }
+    }
 
-    kseq_destroy(seq);
-    fclose(fp);
-    fclose(out);
+    if (!params.stats_file.empty()) {
+        try {
+            stats.write_json(params.stats_file, "scan", params.min_mem_lengths);
+        } catch (const std::runtime_error& e) {
+            error_exit(e.what());
+        }
+    }
 }
 
 void scan_reads(const ScanParams& params) {
     std::ifstream index_stream(params.index_file);
-    
-    SavedOptions options;
-    load_options(index_stream, options);
-    
-    if (use_shift_filter(options.filter_size_mode)) {
-        filter_reads<kebab::KebabIndex<kebab::ShiftFilter>>(params, index_stream);
-    } else {
-        filter_reads<kebab::KebabIndex<kebab::ModFilter>>(params, index_stream);
+    const kebab::IndexHeader header = read_header(index_stream);
+
+    std::shared_ptr<const kebab::MappedFile> mapping;
+    if (params.mmap) {
+        mapping = map_index(params.index_file, header, params.populate, params.huge_pages);
+    }
+
+    kebab::visit_index_type(header.filter_type, header.filter_size_mode, [&](auto tag) {
+        filter_reads<typename decltype(tag)::type>(params, index_stream, header, mapping);
+    });
+}
+
+/* =============================== TUNE =============================== */
+
+struct TuneParams {
+    std::string index_file;
+    std::string reads_file; // a sample of the reads to be scanned, random reads otherwise
+    uint16_t max_threads = DEFAULT_SCAN_THREADS;
+    bool save = true;
+
+    void validate() {
+        std::filesystem::path index_path(index_file);
+        if (index_path.extension() != KEBAB_FILE_SUFFIX) {
+            index_file += KEBAB_FILE_SUFFIX;
+        }
+        if (!std::filesystem::exists(index_file)) {
+            error_exit("Index file does not exist: " + index_file);
+        }
+    }
+};
+
+// Up to TUNE_SAMPLE_BASES of reads, the first of reads_file or random ones without
+std::vector<std::string> tune_sample(const std::string& reads_file) {
+    std::vector<std::string> sample;
+    size_t bases = 0;
+    if (!reads_file.empty()) {
+        SeqFile file;
+        open_seq_file(reads_file, 1, file);
+        while (bases < TUNE_SAMPLE_BASES && read_seq_record(file, true)) {
+            sample.emplace_back(file.seq->seq.s, file.seq->seq.l);
+            bases += file.seq->seq.l;
+        }
+        close_seq_file(file);
+        if (sample.empty()) {
+            error_exit("No reads to tune with in " + reads_file);
+        }
+        return sample;
+    }
+
+    // Reads of random bases miss the filter as often as reads of a distant genome would
+    std::mt19937_64 rng(0);
+    std::uniform_int_distribution<int> base(0, 3);
+    while (bases < TUNE_SAMPLE_BASES) {
+        std::string read(TUNE_SAMPLE_READ_LENGTH, 'A');
+        for (char& c : read) {
+            c = "ACGT"[base(rng)];
+        }
+        bases += read.size();
+        sample.push_back(std::move(read));
+    }
+    return sample;
+}
+
+// Fastest of TUNE_REPEATS scans of the sample on threads threads, in bases per second
+template<typename Index>
+double measure_scan(const Index& index, const std::vector<std::string>& sample, bool prefetch, uint16_t threads) {
+    // Scanned in batches like a real scan, so the ring runs across reads the same way
+    constexpr size_t BATCH_READS = 64;
+    size_t bases = 0;
+    std::vector<kebab::Sequence> reads;
+    for (const std::string& read : sample) {
+        bases += read.size();
+        reads.push_back({read.data(), read.size()});
+    }
+
+    double best = 0;
+    for (size_t repeat = 0; repeat < TUNE_REPEATS; ++repeat) {
+        const auto start_time = std::chrono::steady_clock::now();
+        #pragma omp parallel num_threads(threads)
+        {
+            typename Index::ScanContext context;
+            #pragma omp for schedule(dynamic)
+            for (size_t first = 0; first < reads.size(); first += BATCH_READS) {
+                index.scan_batch(reads.data() + first, std::min(BATCH_READS, reads.size() - first), context, index.get_k() + 1, false, prefetch);
+            }
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        best = std::max(best, bases / seconds);
+    }
+    return best;
+}
+
+template<typename Index>
+void tune_index(const TuneParams& params, std::ifstream& index_stream, const kebab::IndexHeader& header, const std::shared_ptr<const kebab::MappedFile>& mapping) {
+    Index index(index_stream, header.version, mapping);
+    const std::vector<std::string> sample = tune_sample(params.reads_file);
+
+    auto report = [](const std::string& setting, double bases_per_second) {
+        std::cerr << "\t" << setting << ": " << std::fixed << std::setprecision(2) << bases_per_second / 1e6 << "M bases/s" << std::endl;
+    };
+
+    // Brings the filter's pages in, so the first setting isn't charged for faulting them
+    measure_scan(index, sample, true, 1);
+
+    std::cerr << "Prefetch distance (1 thread):" << std::endl;
+    kebab::TuneResult result;
+    double best = 0;
+    for (size_t distance : TUNE_PREFETCH_DISTANCES) {
+        index.set_prefetch_distance(distance);
+        const double bases_per_second = measure_scan(index, sample, distance > 0, 1);
+        report(distance ? std::to_string(distance) + " lines" : "no prefetch", bases_per_second);
+        if (bases_per_second > best) {
+            best = bases_per_second;
+            result.prefetch_distance = distance;
+        }
+    }
+    index.set_prefetch_distance(result.prefetch_distance);
+
+    // Past the point where the filter's memory bandwidth saturates, more threads only add contention
+    std::cerr << "Threads:" << std::endl;
+    std::vector<uint16_t> thread_counts;
+    for (uint16_t threads = 1; threads < params.max_threads; threads *= 2) {
+        thread_counts.push_back(threads);
+    }
+    thread_counts.push_back(params.max_threads);
+    std::vector<double> throughputs;
+    for (uint16_t threads : thread_counts) {
+        throughputs.push_back(measure_scan(index, sample, result.prefetch_distance > 0, threads));
+        report(std::to_string(threads), throughputs.back());
+    }
+    const double best_throughput = *std::max_element(throughputs.begin(), throughputs.end());
+    for (size_t i = 0; i < thread_counts.size(); ++i) {
+        if (throughputs[i] >= (1 - TUNE_THREAD_TOLERANCE) * best_throughput) {
+            result.threads = thread_counts[i];
+            break;
+        }
+    }
+
+    std::cerr << "\tPrefetch distance: " << (result.prefetch_distance ? std::to_string(result.prefetch_distance) : "none (--no-prefetch)") << std::endl;
+    std::cerr << "\tThreads: " << result.threads << std::endl;
+    if (params.save) {
+        try {
+            kebab::save_tune(params.index_file, result);
+            note("Saved to " + kebab::tune_path(params.index_file) + ", scans against this index use it for settings they aren't given (unless --no-tune)");
+        } catch (const std::runtime_error& e) {
+            error_exit(e.what());
+        }
+    }
+}
+
+void tune_scan(const TuneParams& params) {
+    std::ifstream index_stream(params.index_file);
+    const kebab::IndexHeader header = read_header(index_stream);
+    const std::shared_ptr<const kebab::MappedFile> mapping = map_index(params.index_file, header, DEFAULT_POPULATE, DEFAULT_HUGE_PAGES);
+
+    kebab::visit_index_type(header.filter_type, header.filter_size_mode, [&](auto tag) {
+        tune_index<typename decltype(tag)::type>(params, index_stream, header, mapping);
+    });
+}
+
+/* =============================== DECODE =============================== */
+
+struct DecodeParams {
+    std::string fragment_file;
+    std::string output_file;
+    std::vector<std::string> reads_files; // scanned reads and their mates, if paired
+    uint16_t threads = DEFAULT_SCAN_THREADS;
+
+    void validate() {
+        // Add .kbf suffix if not present
+        std::filesystem::path fragment_path(fragment_file);
+        if (fragment_path.extension() != FRAGMENT_FILE_SUFFIX) {
+            fragment_file += FRAGMENT_FILE_SUFFIX;
+        }
+    }
+};
+
+// Writes a binary fragment file as the FASTA scan would have, taking bases from the file or the scanned reads
+void decode_fragments(const DecodeParams& params) {
+    std::unique_ptr<kebab::FragmentReader> reader;
+    try {
+        reader = std::make_unique<kebab::FragmentReader>(params.fragment_file);
+    } catch (const std::runtime_error& e) {
+        error_exit(e.what());
+    }
+
+    const bool from_reads = !reader->has_sequences();
+    if (from_reads && params.reads_files.empty()) {
+        error_exit("Fragment file has no sequences (scanned without --pack-seq), pass the scanned reads with --reads");
+    }
+    if (!from_reads && !params.reads_files.empty()) {
+        note("Fragment file stores its sequences, ignoring --reads");
+    }
+
+    // Reads are consumed in step with the records, as scan numbered them
+    const bool paired = params.reads_files.size() == 2;
+    SeqFile reads;
+    SeqFile mates;
+    if (from_reads) {
+        open_seq_file(params.reads_files[0], params.threads, reads);
+        if (paired) {
+            open_seq_file(params.reads_files[1], params.threads, mates);
+        }
+    }
+    uint64_t next_read = 0;
+    const kseq_t* read = nullptr;
+
+    FILE* out = fopen(params.output_file.c_str(), "w");
+    if (!out) {
+        error_exit("Problem opening output file (" + params.output_file + ")");
+    }
+    kebab::OutputBuffer buffer;
+    std::string bases;
+
+    kebab::FragmentRecord record;
+    try {
+        while (reader->next(record)) {
+            if (from_reads) {
+                while (next_read <= record.read_id) {
+                    SeqFile& from = (paired && next_read % 2) ? mates : reads;
+                    if (!read_seq_record(from, !paired)) {
+                        close_seq_file(from);
+                        error_exit("Reads end before read " + record.name + " of the fragment file");
+                    }
+                    read = from.seq;
+                    ++next_read;
+                }
+                const size_t name_len = paired ? mate_name_len(read) : read->name.l;
+                if (record.name.size() != name_len || std::memcmp(record.name.data(), read->name.s, name_len) != 0) {
+                    error_exit("Reads don't match the fragment file, expected " + record.name + " but found " + std::string(read->name.s, read->name.l));
+                }
+            }
+
+            for (size_t i = 0; i < record.fragments.size(); ++i) {
+                const kebab::Fragment& fragment = record.fragments[i];
+                const char* seq;
+                if (from_reads) {
+                    if (fragment.start + fragment.length > read->seq.l) {
+                        error_exit("Reads don't match the fragment file, " + record.name + " is shorter than its fragments");
+                    }
+                    seq = read->seq.s + fragment.start;
+                }
+                else {
+                    record.get_sequence(i, bases);
+                    seq = bases.data();
+                }
+                append_fragment_record(buffer, record.name.data(), record.name.size(), record.mate, fragment, seq, nullptr);
+            }
+
+            if (buffer.size() >= SEQ_BATCH_BYTES) {
+                fwrite(buffer.c_str(), 1, buffer.size(), out);
+                buffer.clear();
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        error_exit(e.what());
+    }
+    fwrite(buffer.c_str(), 1, buffer.size(), out);
+
+    if (from_reads) {
+        close_seq_file(reads);
+        if (paired) {
+            close_seq_file(mates);
+        }
+    }
+    if (fclose(out) != 0) {
+        error_exit("Problem writing output file (" + params.output_file + ")");
     }
 }
 
@@ -383,7 +1368,7 @@ int main(int argc, char** argv) {
     bool no_filter_rounding = false;
     build_params.threads = omp_get_max_threads();
 
-    build->add_option("fasta", build_params.fasta_file, "Input FASTA file")->required();
+    build->add_option("fasta", build_params.fasta_file, "Input FASTA/FASTQ file")->required();
     build->add_option("-o,--output", build_params.output_prefix, "Output prefix for index file, [PREFIX]" + std::string(KEBAB_FILE_SUFFIX))->required();
     build->add_option("-k,--kmer-size", build_params.kmer_size, "K-mer size used to populate the index")
         ->default_val(DEFAULT_KMER_SIZE)
@@ -408,32 +1393,127 @@ int main(int argc, char** argv) {
         ->default_val(build_params.threads)
         ->check(CLI::PositiveNumber);
     build->add_flag("--no-rounding", no_filter_rounding, "Don't round to power of 2 for filter size (slower)");
+    build->add_option("--filter-type", build_params.filter_type, "Bloom filter layout (blocked uses one cache line per k-mer)")
+        ->default_val(DEFAULT_FILTER_TYPE)
+        ->transform(CLI::CheckedTransformer(std::map<std::string, FilterType>{
+            {"standard", FilterType::STANDARD},
+            {"blocked", FilterType::BLOCKED}
+        }));
+    build->add_flag("--single-pass", build_params.single_pass, "Read the input once, keeping k-mer hashes from estimation to insert (without -m)");
+    build->add_option("--spool-memory", build_params.spool_memory, "Memory (MB) for hashes kept by --single-pass, the rest spill to [PREFIX]" + std::string(SPOOL_FILE_SUFFIX))
+        ->default_val(DEFAULT_SPOOL_MEMORY);
+    build->add_flag("!--no-sketch", build_params.sketch_cache, "Don't reuse or save the k-mer estimation sketch beside the input");
+    build->add_option("--stats", build_params.stats_file, "Write run statistics (throughput, k-mers, time per phase) as JSON to this file");
+    auto append_option = build->add_option("--append", build_params.append_index, "Insert into this existing index instead of building a new one (keeps its k, k-mer mode and filter)");
+    build->add_option("--max-fp-rate", build_params.max_fp_rate, "Warn when appending raises the observed false positive rate above this")
+        ->default_val(DEFAULT_MAX_FP_RATE)
+        ->type_name("FLOAT")
+        ->needs(append_option);
+    // Fixed by the index being appended to
+    for (const char* sizing : {"--kmer-size", "--kmer-mode", "--expected-kmers", "--fp-rate", "--hash-funcs", "--no-rounding", "--filter-type", "--single-pass"}) {
+        append_option->excludes(build->get_option(sizing));
+    }
+
+    // MERGE COMMAND
+    auto merge = app.add_subcommand("merge", "Merges KeBaB indexes built with the same k, k-mer mode and filter size into one");
+
+    MergeParams merge_params;
+
+    merge->add_option("indexes", merge_params.index_files, "KeBaB index files to merge")->required();
+    merge->add_option("-o,--output", merge_params.output_prefix, "Output prefix for merged index file, [PREFIX]" + std::string(KEBAB_FILE_SUFFIX))->required();
+    merge->add_option("--max-fp-rate", merge_params.max_fp_rate, "Warn when the merged index's observed false positive rate is above this")
+        ->default_val(DEFAULT_MAX_FP_RATE)
+        ->type_name("FLOAT");
+
+    // FOLD COMMAND
+    auto fold = app.add_subcommand("fold", "Halves a KeBaB index's filter to fit in cache, at a higher false positive rate");
+
+    FoldParams fold_params;
+
+    fold->add_option("-i,--index", fold_params.index_file, "KeBaB index file (built without --no-rounding)")->required();
+    fold->add_option("-o,--output", fold_params.output_prefix, "Output prefix for folded index file, [PREFIX]" + std::string(KEBAB_FILE_SUFFIX))->required();
+    auto folds_option = fold->add_option("-n,--folds", fold_params.folds, "Number of times to halve the filter")
+        ->default_val(DEFAULT_FOLDS)
+        ->check(CLI::PositiveNumber);
+    fold->add_option("--max-size", fold_params.max_size, "Halve the filter until it is at most this many KB (e.g., the L2 or L3 cache size)")
+        ->check(CLI::PositiveNumber)
+        ->excludes(folds_option);
+    fold->add_option("--max-fp-rate", fold_params.max_fp_rate, "Warn when the folded index's observed false positive rate is above this")
+        ->default_val(DEFAULT_MAX_FP_RATE)
+        ->type_name("FLOAT");
 
     // SCAN COMMAND
     auto scan = app.add_subcommand("scan", "Breaks sequences into fragments using KeBaB index");
 
     ScanParams scan_params;
     bool no_prefetch = false;
+    bool no_mmap = false;
     bool threads_set = false;
     scan_params.threads = (DEFAULT_PREFETCH) ? omp_get_num_procs() : omp_get_max_threads();
 
-    scan->add_option("fasta", scan_params.fasta_file, "Patterns FASTA file")->required();
+    scan->add_option("fasta", scan_params.fasta_file, "Patterns FASTA/FASTQ file")->required();
+    scan->add_option("mates", scan_params.mate_file, "Mates of the patterns, scanned as paired-end reads named [NAME]/1 and [NAME]/2");
     scan->add_option("-i,--index", scan_params.index_file, "KeBaB index file")->required();
-    scan->add_option("-o,--output", scan_params.output_file, "Output FASTA file")->required();
-    scan->add_option("-l,--mem-length", scan_params.min_mem_length, "Minimum MEM length (must be greater than k-mer size of index)")
+    scan->add_option("-o,--output", scan_params.output_file, "Output FASTA file (FASTQ with --keep-qualities, [PREFIX]" + std::string(FRAGMENT_FILE_SUFFIX) + " with --binary)")->required();
+    scan->add_option("-l,--mem-length", scan_params.min_mem_lengths, "Minimum MEM length (must be greater than k-mer size of index), a comma separated list scans once into an output each")
         ->default_val(DEFAULT_MIN_MEM_LENGTH)
+        ->allow_extra_args(false)
+        ->delimiter(',')
         ->check(CLI::PositiveNumber);
     scan->add_option("--top-t", scan_params.top_t, "Keep only top-t longest fragments")
         ->check(CLI::PositiveNumber);
     scan->add_flag("-s,--sort", scan_params.sort_fragments, "Sort fragments by length");
     scan->add_flag("-r,--remove-overlaps", scan_params.remove_overlaps, "Merge overlapping fragments");
+    scan->add_flag("--ordered", scan_params.ordered, "Write fragments in input order (reproducible output)");
+    scan->add_flag("-q,--keep-qualities", scan_params.keep_qualities, "Write fragments as FASTQ with their quality strings (FASTQ input)");
+    auto binary_flag = scan->add_flag("-b,--binary", scan_params.binary, "Write fragments as ranges in a compact binary file (see decode)");
+    scan->add_flag("--pack-seq", scan_params.pack_sequences, "Also store fragment bases 2-bit packed, so decoding needs no reads")
+        ->needs(binary_flag);
     scan->add_option("-t,--threads", scan_params.threads, "Number of threads to use")
         ->default_val(scan_params.threads)
         ->check(CLI::PositiveNumber);
     scan->add_flag("--no-prefetch", no_prefetch, "Don't prefetch k-mers to avoid latency");
+    scan->add_flag("--skip-ahead", scan_params.skip_ahead, "Query only k-mers that can change the fragments, for reads mostly absent from the index");
+    scan->add_option("--prefetch-distance", scan_params.prefetch_distance, "Filter cache lines kept in flight when prefetching (otherwise tuned, see tune)")
+        ->default_val(PREFETCH_DISTANCE)
+        ->check(CLI::PositiveNumber);
+    scan->add_flag("!--no-tune", scan_params.use_tuning, "Ignore settings saved beside the index by tune");
+    scan->add_flag("--no-mmap", no_mmap, "Read the index into memory instead of memory-mapping it");
+    scan->add_flag("--populate", scan_params.populate, "Pre-fault the whole memory-mapped index before scanning");
+    scan->add_flag("--huge-pages", scan_params.huge_pages, "Request transparent huge pages for the memory-mapped index");
+    scan->add_option("--fold", scan_params.folds, "Halve a power of two sized filter this many times once loaded, for a smaller index at a higher false positive rate (see fold)")
+        ->default_val(DEFAULT_SCAN_FOLDS);
+    scan->add_option("--stats", scan_params.stats_file, "Write run statistics (throughput, hit and retention ratios, time per phase) as JSON to this file");
 
     threads_set = (scan->count("--threads") > 0);
 
+    // TUNE COMMAND
+    auto tune = app.add_subcommand("tune", "Measures the fastest prefetch distance and thread count for scanning against an index");
+
+    TuneParams tune_params;
+    tune_params.max_threads = omp_get_num_procs();
+
+    tune->add_option("reads", tune_params.reads_file, "Sample of the reads to be scanned (otherwise random reads)");
+    tune->add_option("-i,--index", tune_params.index_file, "KeBaB index file")->required();
+    tune->add_option("-t,--max-threads", tune_params.max_threads, "Most threads to try")
+        ->default_val(tune_params.max_threads)
+        ->check(CLI::PositiveNumber);
+    tune->add_flag("!--no-save", tune_params.save, "Only report the settings, don't save them beside the index");
+
+    // DECODE COMMAND
+    auto decode = app.add_subcommand("decode", "Writes the fragments of a binary fragment file as FASTA");
+
+    DecodeParams decode_params;
+    decode_params.threads = omp_get_max_threads();
+
+    decode->add_option("fragments", decode_params.fragment_file, "Fragment file written by scan --binary, [PREFIX]" + std::string(FRAGMENT_FILE_SUFFIX))->required();
+    decode->add_option("-o,--output", decode_params.output_file, "Output FASTA file")->required();
+    decode->add_option("--reads", decode_params.reads_files, "Scanned reads (and mates), needed unless scanned with --pack-seq")
+        ->expected(1, 2);
+    decode->add_option("-t,--threads", decode_params.threads, "Number of threads to decompress reads with")
+        ->default_val(decode_params.threads)
+        ->check(CLI::PositiveNumber);
+
     try {
         app.parse(argc, argv);
         
@@ -442,11 +1522,28 @@ int main(int argc, char** argv) {
             omp_set_num_threads(build_params.threads);
             build_index(build_params);
         }
+        if (merge->parsed()) {
+            merge_params.validate();
+            merge_indexes(merge_params);
+        }
+        if (fold->parsed()) {
+            fold_params.validate();
+            fold_filter(fold_params);
+        }
         if (scan->parsed()) {
-            scan_params.validate(no_prefetch, threads_set);
+            scan_params.validate(no_prefetch, no_mmap, threads_set);
+            scan_params.apply_tuning(no_prefetch, threads_set, scan->count("--prefetch-distance") > 0);
             omp_set_num_threads(scan_params.threads);
             scan_reads(scan_params);
         }
+        if (tune->parsed()) {
+            tune_params.validate();
+            tune_scan(tune_params);
+        }
+        if (decode->parsed()) {
+            decode_params.validate();
+            decode_fragments(decode_params);
+        }
 
     } catch (const CLI::ParseError &e) {
         return app.exit(e);
@@ -0,0 +1,169 @@
+#include "kebab/api.hpp"
+
+#include <fstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "kebab/index_file.hpp"
+#include "kebab/mapped_file.hpp"
+
+namespace kebab {
+
+namespace {
+
+// Type-erased KebabIndex, one implementation per filter layout
+class IndexBackend {
+public:
+    virtual ~IndexBackend() = default;
+
+    virtual size_t get_k() const noexcept = 0;
+    virtual KmerMode get_kmer_mode() const noexcept = 0;
+    virtual std::string get_stats() const = 0;
+    // Fragments live in a per-thread context owned by the backend, valid until the thread's next scan
+    virtual std::vector<Fragment>& scan(const char* seq, size_t len, const ScanOptions& options) const = 0;
+    // Same for a batch, fragments of sequence i are fragments[offsets[i]] up to fragments[offsets[i + 1]]
+    virtual std::vector<Fragment>& scan_batch(const Sequence* seqs, size_t count, const ScanOptions& options, const std::vector<size_t>*& offsets) const = 0;
+};
+
+template<typename IndexType>
+class FilterBackend final : public IndexBackend {
+public:
+    FilterBackend(std::istream& in, uint32_t version, const std::shared_ptr<const MappedFile>& mapping)
+        : index(in, version, mapping) {}
+
+    size_t get_k() const noexcept override { return index.get_k(); }
+    KmerMode get_kmer_mode() const noexcept override { return index.get_kmer_mode(); }
+    std::string get_stats() const override { return index.get_stats(); }
+
+    std::vector<Fragment>& scan(const char* seq, size_t len, const ScanOptions& options) const override {
+        typename IndexType::ScanContext& context = thread_context();
+        // Top-t is selected during the scan unless overlaps are merged, which has to see every fragment first
+        const size_t top_t = options.remove_overlaps ? 0 : options.top_t;
+        index.scan_read(seq, len, context, options.min_mem_length, options.remove_overlaps, options.prefetch, top_t, options.skip_ahead);
+        return context.get_fragments();
+    }
+
+    std::vector<Fragment>& scan_batch(const Sequence* seqs, size_t count, const ScanOptions& options, const std::vector<size_t>*& offsets) const override {
+        typename IndexType::ScanContext& context = thread_context();
+        const size_t top_t = options.remove_overlaps ? 0 : options.top_t;
+        index.scan_batch(seqs, count, context, options.min_mem_length, options.remove_overlaps, options.prefetch, top_t, options.skip_ahead);
+        offsets = &context.get_batch_offsets();
+        return context.get_batch_fragments();
+    }
+
+private:
+    IndexType index;
+
+    // Shared by single and batch scans, so either grows the storage the other reuses
+    static typename IndexType::ScanContext& thread_context() {
+        thread_local static typename IndexType::ScanContext context;
+        return context;
+    }
+};
+
+// Applies sort and top_t to fragments a backend found for one sequence, returns how many are kept
+size_t finish_fragments(Fragment* fragments, size_t count, const ScanOptions& options) {
+    if (options.top_t && !options.remove_overlaps) {
+        return count; // already the top_t, sorted
+    }
+    if (options.sort || options.top_t) {
+        std::sort(fragments, fragments + count);
+    }
+    return (options.top_t && count > options.top_t) ? options.top_t : count;
+}
+
+const std::vector<Fragment>& scan_one(const IndexBackend& backend, const char* seq, size_t len, const ScanOptions& options) {
+    std::vector<Fragment>& fragments = backend.scan(seq, len, options);
+    fragments.resize(finish_fragments(fragments.data(), fragments.size(), options));
+    return fragments;
+}
+
+} // namespace
+
+struct Index::Impl {
+    std::unique_ptr<IndexBackend> backend;
+    bool mapped = false;
+};
+
+Index::Index(std::unique_ptr<Impl> impl) : impl(std::move(impl)) {}
+
+Index::~Index() = default;
+Index::Index(Index&& other) noexcept = default;
+Index& Index::operator=(Index&& other) noexcept = default;
+
+Index Index::open(const std::string& path, const OpenOptions& options) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Problem opening index (" + path + ")");
+    }
+    IndexHeader header = read_index_header(in);
+
+    std::shared_ptr<const MappedFile> mapping;
+    if (options.mmap && header.version >= ALIGNED_PAYLOAD_VERSION) {
+        try {
+            mapping = std::make_shared<MappedFile>(path, MapOptions{options.populate, options.huge_pages});
+        } catch (const std::runtime_error&) {
+            // Read into memory instead, see is_mapped
+        }
+    }
+
+    auto impl = std::make_unique<Impl>();
+    impl->mapped = static_cast<bool>(mapping);
+    impl->backend = visit_index_type(header.filter_type, header.filter_size_mode, [&](auto tag) -> std::unique_ptr<IndexBackend> {
+        return std::make_unique<FilterBackend<typename decltype(tag)::type>>(in, header.version, mapping);
+    });
+    if (!in) {
+        throw std::runtime_error("Index file is truncated (" + path + ")");
+    }
+    return Index(std::move(impl));
+}
+
+size_t Index::get_k() const noexcept {
+    return impl->backend->get_k();
+}
+
+KmerMode Index::get_kmer_mode() const noexcept {
+    return impl->backend->get_kmer_mode();
+}
+
+bool Index::is_mapped() const noexcept {
+    return impl->mapped;
+}
+
+std::string Index::get_stats() const {
+    return impl->backend->get_stats();
+}
+
+size_t Index::scan(const char* seq, size_t len, Fragment* out, size_t capacity, const ScanOptions& options) const {
+    const std::vector<Fragment>& fragments = scan_one(*impl->backend, seq, len, options);
+    std::copy_n(fragments.begin(), std::min(capacity, fragments.size()), out);
+    return fragments.size();
+}
+
+void Index::scan_batch(const Sequence* seqs, size_t count, std::vector<Fragment>& fragments, std::vector<size_t>& offsets, const ScanOptions& options) const {
+    const std::vector<size_t>* batch_offsets;
+    std::vector<Fragment>& batch_fragments = impl->backend->scan_batch(seqs, count, options, batch_offsets);
+    fragments.clear();
+    offsets.resize(count + 1);
+    offsets[0] = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Fragment* seq_fragments = batch_fragments.data() + (*batch_offsets)[i];
+        const size_t kept = finish_fragments(seq_fragments, (*batch_offsets)[i + 1] - (*batch_offsets)[i], options);
+        fragments.insert(fragments.end(), seq_fragments, seq_fragments + kept);
+        offsets[i + 1] = fragments.size();
+    }
+}
+
+void Index::scan_batch(const Sequence* seqs, size_t count, const FragmentCallback& on_fragment, const ScanOptions& options) const {
+    const std::vector<size_t>* batch_offsets;
+    std::vector<Fragment>& batch_fragments = impl->backend->scan_batch(seqs, count, options, batch_offsets);
+    for (size_t i = 0; i < count; ++i) {
+        Fragment* seq_fragments = batch_fragments.data() + (*batch_offsets)[i];
+        const size_t kept = finish_fragments(seq_fragments, (*batch_offsets)[i + 1] - (*batch_offsets)[i], options);
+        for (size_t j = 0; j < kept; ++j) {
+            on_fragment(i, seq_fragments[j]);
+        }
+    }
+}
+
+} // namespace kebab
@@ -0,0 +1,43 @@
+#include "kebab/file_util.hpp"
+
+#include <fstream>
+#include <filesystem>
+#include <stdexcept>
+#include <system_error>
+#include <atomic>
+#include <cstdio>
+#include <unistd.h>
+
+namespace kebab {
+
+bool stat_file(const std::string& path, uint64_t& size, int64_t& mtime) {
+    std::error_code error;
+    size = std::filesystem::file_size(path, error);
+    if (error) {
+        return false;
+    }
+    mtime = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+void write_file_atomically(const std::string& path, const std::string& what, const std::function<void(std::ostream&)>& write) {
+    // Unique to the process and call, so writers racing on the same path each write their own file and the last rename wins
+    static std::atomic<uint64_t> writes(0);
+    const std::string partial_path = path + ".partial." + std::to_string(getpid()) + "." + std::to_string(writes++);
+    std::ofstream out(partial_path, std::ios::binary);
+    if (out) {
+        write(out);
+    }
+    // Closed first, as the last of the buffer is only written then
+    out.close();
+    if (out.fail()) {
+        std::remove(partial_path.c_str());
+        throw std::runtime_error("Problem writing " + what + " (" + path + ")");
+    }
+    if (std::rename(partial_path.c_str(), path.c_str()) != 0) {
+        std::remove(partial_path.c_str());
+        throw std::runtime_error("Problem writing " + what + " (" + path + ")");
+    }
+}
+
+} // namespace kebab
@@ -0,0 +1,232 @@
+#include "kebab/fragment_file.hpp"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+namespace kebab {
+
+namespace {
+
+constexpr size_t BLOCK_HEADER_BYTES = 3 * sizeof(uint64_t);
+constexpr char PACKED_BASES[] = "ACTG";
+
+void append_varint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7F) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+void append_u64(std::string& out, uint64_t v) {
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+// Same code as the hash kernels' table index, (c >> 1) & 3 is A, C, T, G for both cases
+void append_packed(std::string& out, const char* seq, size_t len) {
+    for (size_t i = 0; i < len; i += 4) {
+        uint8_t byte = 0;
+        const size_t n = std::min<size_t>(4, len - i);
+        for (size_t j = 0; j < n; ++j) {
+            byte |= static_cast<uint8_t>(((static_cast<uint8_t>(seq[i + j]) >> 1) & 3) << (2 * j));
+        }
+        out.push_back(static_cast<char>(byte));
+    }
+}
+
+size_t packed_bytes(size_t len) {
+    return (len + 3) / 4;
+}
+
+} // namespace
+
+void write_fragment_file_header(FILE* out, bool packed) {
+    const uint32_t flags = packed ? FRAGMENT_FILE_PACKED : 0;
+    if (std::fwrite(&FRAGMENT_FILE_MAGIC, sizeof(FRAGMENT_FILE_MAGIC), 1, out) != 1
+        || std::fwrite(&FRAGMENT_FILE_VERSION, sizeof(FRAGMENT_FILE_VERSION), 1, out) != 1
+        || std::fwrite(&flags, sizeof(flags), 1, out) != 1) {
+        throw std::runtime_error("Problem writing fragment file header");
+    }
+}
+
+FragmentBlockWriter::FragmentBlockWriter(std::string& out, uint64_t batch_id, uint64_t first_read_id, bool packed)
+    : out(out)
+    , block_start(out.size())
+    , packed(packed)
+{
+    append_u64(out, batch_id);
+    append_u64(out, first_read_id);
+    append_u64(out, 0); // payload size, set by finish
+}
+
+void FragmentBlockWriter::add(size_t read_index, const char* name, size_t name_len, uint8_t mate, const char* seq, const Fragment* fragments, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    append_varint(out, read_index);
+    append_varint(out, name_len);
+    out.append(name, name_len);
+    append_varint(out, mate);
+    append_varint(out, count);
+    for (size_t i = 0; i < count; ++i) {
+        append_varint(out, fragments[i].start);
+        append_varint(out, fragments[i].length);
+    }
+    if (packed) {
+        for (size_t i = 0; i < count; ++i) {
+            append_packed(out, seq + fragments[i].start, fragments[i].length);
+        }
+    }
+}
+
+void FragmentBlockWriter::finish() {
+    const uint64_t payload_bytes = out.size() - block_start - BLOCK_HEADER_BYTES;
+    std::memcpy(&out[block_start + 2 * sizeof(uint64_t)], &payload_bytes, sizeof(payload_bytes));
+}
+
+void FragmentRecord::get_sequence(size_t i, std::string& seq) const {
+    if (packed_offsets.size() != fragments.size()) {
+        throw std::runtime_error("Fragment file has no sequences");
+    }
+    const size_t len = fragments[i].length;
+    const uint8_t* bases = packed.data() + packed_offsets[i];
+    seq.resize(len);
+    for (size_t j = 0; j < len; ++j) {
+        seq[j] = PACKED_BASES[(bases[j / 4] >> (2 * (j % 4))) & 3];
+    }
+}
+
+FragmentReader::FragmentReader(const std::string& path)
+    : in(std::fopen(path.c_str(), "rb"))
+    , path(path)
+    , packed(false)
+    , next_batch(0)
+    , pending()
+    , current()
+    , pos(0)
+{
+    if (!in) {
+        throw std::runtime_error("Problem opening fragment file (" + path + ")");
+    }
+    uint32_t magic = 0;
+    uint32_t version = 0;
+    uint32_t flags = 0;
+    if (std::fread(&magic, sizeof(magic), 1, in) != 1 || magic != FRAGMENT_FILE_MAGIC
+        || std::fread(&version, sizeof(version), 1, in) != 1 || std::fread(&flags, sizeof(flags), 1, in) != 1) {
+        std::fclose(in);
+        throw std::runtime_error("Not a KeBaB fragment file (" + path + ")");
+    }
+    if (version > FRAGMENT_FILE_VERSION) {
+        std::fclose(in);
+        throw std::runtime_error("Fragment file was written by a newer version of KeBaB (format " + std::to_string(version) + ")");
+    }
+    packed = flags & FRAGMENT_FILE_PACKED;
+}
+
+FragmentReader::~FragmentReader() {
+    std::fclose(in);
+}
+
+bool FragmentReader::read_block(uint64_t& batch_id, Block& block) {
+    uint64_t header[3];
+    const size_t got = std::fread(header, 1, sizeof(header), in);
+    if (got == 0 && std::feof(in)) {
+        return false;
+    }
+    if (got != sizeof(header)) {
+        throw std::runtime_error("Truncated fragment file (" + path + ")");
+    }
+    batch_id = header[0];
+    block.first_read_id = header[1];
+    block.payload.resize(header[2]);
+    if (std::fread(block.payload.data(), 1, block.payload.size(), in) != block.payload.size()) {
+        throw std::runtime_error("Truncated fragment file (" + path + ")");
+    }
+    return true;
+}
+
+bool FragmentReader::next_block() {
+    // Blocks arrive at most a writer's window out of order, so few are ever held back
+    auto it = pending.find(next_batch);
+    while (it == pending.end()) {
+        uint64_t batch_id;
+        Block block;
+        if (!read_block(batch_id, block)) {
+            if (!pending.empty()) {
+                throw std::runtime_error("Fragment file is missing blocks (" + path + ")");
+            }
+            return false;
+        }
+        if (batch_id < next_batch || !pending.emplace(batch_id, std::move(block)).second) {
+            throw std::runtime_error("Fragment file repeats a block (" + path + ")");
+        }
+        it = pending.find(next_batch);
+    }
+    current = std::move(it->second);
+    pending.erase(it);
+    pos = 0;
+    ++next_batch;
+    return true;
+}
+
+bool FragmentReader::next(FragmentRecord& record) {
+    while (pos == current.payload.size()) {
+        if (!next_block()) {
+            return false;
+        }
+    }
+
+    const uint8_t* data = current.payload.data();
+    const size_t end = current.payload.size();
+    auto read_varint = [&]() {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (pos == end) {
+                break;
+            }
+            const uint8_t byte = data[pos++];
+            v |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) {
+                return v;
+            }
+        }
+        throw std::runtime_error("Malformed fragment file (" + path + ")");
+    };
+    auto check_bytes = [&](size_t bytes) {
+        if (bytes > end - pos) {
+            throw std::runtime_error("Malformed fragment file (" + path + ")");
+        }
+    };
+
+    record.read_id = current.first_read_id + read_varint();
+    const size_t name_len = read_varint();
+    check_bytes(name_len);
+    record.name.assign(reinterpret_cast<const char*>(data + pos), name_len);
+    pos += name_len;
+    record.mate = static_cast<uint8_t>(read_varint());
+
+    const size_t count = read_varint();
+    check_bytes(count); // at least a byte per fragment
+    record.fragments.resize(count);
+    for (Fragment& fragment : record.fragments) {
+        fragment.start = read_varint();
+        fragment.length = read_varint();
+    }
+
+    record.packed.clear();
+    record.packed_offsets.clear();
+    if (packed) {
+        size_t bytes = 0;
+        for (const Fragment& fragment : record.fragments) {
+            record.packed_offsets.push_back(bytes);
+            bytes += packed_bytes(fragment.length);
+        }
+        check_bytes(bytes);
+        record.packed.assign(data + pos, data + pos + bytes);
+        pos += bytes;
+    }
+    return true;
+}
+
+} // namespace kebab
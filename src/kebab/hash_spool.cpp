@@ -0,0 +1,105 @@
+#include "kebab/hash_spool.hpp"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace kebab {
+
+HashSpool::HashSpool(size_t memory_budget, const std::string& spill_path)
+    : memory_budget(memory_budget)
+    , memory_used(0)
+    , spill_path(spill_path)
+    , spill_fd(-1)
+    , spilled_bytes(0)
+    , num_hashes(0)
+    , error()
+    , chunks()
+{
+}
+
+HashSpool::~HashSpool() {
+    if (spill_fd >= 0) {
+        close(spill_fd);
+    }
+}
+
+void HashSpool::add(std::vector<uint64_t>&& hashes) {
+    if (hashes.empty()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (!error.empty()) {
+        return;
+    }
+
+    Chunk chunk{std::vector<uint64_t>(), 0, hashes.size()};
+    const size_t bytes = hashes.size() * sizeof(uint64_t);
+    if (memory_used + bytes <= memory_budget) {
+        memory_used += bytes;
+        chunk.hashes = std::move(hashes);
+    }
+    else {
+        try {
+            spill(chunk, hashes);
+        } catch (const std::runtime_error& e) {
+            error = e.what();
+            return;
+        }
+    }
+    num_hashes += chunk.count;
+    chunks.push_back(std::move(chunk));
+}
+
+void HashSpool::spill(Chunk& chunk, const std::vector<uint64_t>& hashes) {
+    if (spill_fd < 0) {
+        spill_fd = open(spill_path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (spill_fd < 0) {
+            throw std::runtime_error("Problem creating hash spool file (" + spill_path + "): " + std::strerror(errno));
+        }
+        unlink(spill_path.c_str());
+    }
+
+    chunk.offset = spilled_bytes;
+    const char* data = reinterpret_cast<const char*>(hashes.data());
+    const size_t bytes = hashes.size() * sizeof(uint64_t);
+    for (size_t written = 0; written < bytes; ) {
+        ssize_t n = pwrite(spill_fd, data + written, bytes - written, static_cast<off_t>(spilled_bytes + written));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Problem writing hash spool file (" + spill_path + "): " + std::strerror(errno));
+        }
+        written += static_cast<size_t>(n);
+    }
+    spilled_bytes += bytes;
+}
+
+const uint64_t* HashSpool::get_chunk(size_t i, std::vector<uint64_t>& buffer, size_t& count) const {
+    const Chunk& chunk = chunks[i];
+    count = chunk.count;
+    if (!chunk.hashes.empty()) {
+        return chunk.hashes.data();
+    }
+
+    buffer.resize(chunk.count);
+    char* data = reinterpret_cast<char*>(buffer.data());
+    const size_t bytes = chunk.count * sizeof(uint64_t);
+    for (size_t done = 0; done < bytes; ) {
+        ssize_t n = pread(spill_fd, data + done, bytes - done, static_cast<off_t>(chunk.offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            throw std::runtime_error("Problem reading hash spool file (" + spill_path + "): " + std::strerror(errno));
+        }
+        done += static_cast<size_t>(n);
+    }
+    return buffer.data();
+}
+
+} // namespace kebab
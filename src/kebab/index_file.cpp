@@ -0,0 +1,38 @@
+#include "kebab/index_file.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace kebab {
+
+void write_index_header(std::ostream& out, FilterSizeMode filter_size_mode, FilterType filter_type) {
+    out.write(reinterpret_cast<const char*>(&KEBAB_FILE_MAGIC), sizeof(KEBAB_FILE_MAGIC));
+    out.write(reinterpret_cast<const char*>(&KEBAB_FILE_VERSION), sizeof(KEBAB_FILE_VERSION));
+    out.write(reinterpret_cast<const char*>(&filter_size_mode), sizeof(filter_size_mode));
+    out.write(reinterpret_cast<const char*>(&filter_type), sizeof(filter_type));
+}
+
+IndexHeader read_index_header(std::istream& in) {
+    IndexHeader header;
+    uint32_t magic = 0;
+    in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+
+    // Legacy indexes start directly with the filter size mode and only use standard filters
+    if (magic != KEBAB_FILE_MAGIC) {
+        header.version = 1;
+        std::memcpy(&header.filter_size_mode, &magic, sizeof(header.filter_size_mode));
+        header.filter_type = FilterType::STANDARD;
+        return header;
+    }
+
+    in.read(reinterpret_cast<char*>(&header.version), sizeof(header.version));
+    if (header.version > KEBAB_FILE_VERSION) {
+        throw std::runtime_error("Index was built with a newer version of KeBaB (format " + std::to_string(header.version) + ")");
+    }
+    in.read(reinterpret_cast<char*>(&header.filter_size_mode), sizeof(header.filter_size_mode));
+    in.read(reinterpret_cast<char*>(&header.filter_type), sizeof(header.filter_type));
+    return header;
+}
+
+} // namespace kebab
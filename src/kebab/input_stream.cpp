@@ -0,0 +1,445 @@
+#include "kebab/input_stream.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "constants.hpp"
+
+namespace kebab {
+
+namespace {
+
+constexpr unsigned char GZIP_ID1 = 0x1f;
+constexpr unsigned char GZIP_ID2 = 0x8b;
+constexpr unsigned char GZIP_DEFLATE = 8;
+constexpr unsigned char GZIP_FEXTRA = 0x04;
+constexpr size_t GZIP_FIXED_HEADER_BYTES = 12; // including XLEN, which is only meaningful with FEXTRA
+constexpr size_t GZIP_FOOTER_BYTES = 8;        // CRC32, ISIZE
+
+uint16_t read_le16(const unsigned char* p) noexcept {
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+uint32_t read_le32(const unsigned char* p) noexcept {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Total size of the BGZF block whose header (fixed part and extra field) is given, 0 if it isn't one
+size_t bgzf_block_size(const unsigned char* header, size_t len) noexcept {
+    if (len < GZIP_FIXED_HEADER_BYTES || header[0] != GZIP_ID1 || header[1] != GZIP_ID2 || header[2] != GZIP_DEFLATE || !(header[3] & GZIP_FEXTRA)) {
+        return 0;
+    }
+    const size_t xlen = read_le16(header + 10);
+    if (len < GZIP_FIXED_HEADER_BYTES + xlen) {
+        return 0;
+    }
+
+    // Extra subfields are SI1, SI2, SLEN, then SLEN bytes, BGZF stores BSIZE (block size - 1) under "BC"
+    const unsigned char* extra = header + GZIP_FIXED_HEADER_BYTES;
+    for (size_t pos = 0; pos + 4 <= xlen; ) {
+        const size_t slen = read_le16(extra + pos + 2);
+        if (extra[pos] == 'B' && extra[pos + 1] == 'C' && slen == 2 && pos + 6 <= xlen) {
+            return static_cast<size_t>(read_le16(extra + pos + 4)) + 1;
+        }
+        pos += 4 + slen;
+    }
+    return 0;
+}
+
+// Reads until len bytes or the end of the file, returns bytes read or -1 on error
+ssize_t read_full(int fd, void* buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t n = ::read(fd, static_cast<char*>(buf) + total, len - total);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        total += static_cast<size_t>(n);
+    }
+    return static_cast<ssize_t>(total);
+}
+
+} // namespace
+
+const char* compression_name(Compression compression) noexcept {
+    switch (compression) {
+        case Compression::NONE: return "none";
+        case Compression::GZIP: return "gzip";
+        case Compression::BGZF: return "bgzf";
+    }
+    return "unknown";
+}
+
+InputStream::InputStream(const std::string& path, uint16_t threads)
+    : path(path)
+    , fd(-1)
+    , compression(Compression::NONE)
+    , file_size(0)
+    , bytes_consumed(0)
+    , error()
+    , chunks()
+    , compressed_chunks()
+    , num_chunks(0)
+    , next_chunk(0)
+    , chunk_pos(0)
+    , input_done(false)
+    , stopping(false)
+{
+    fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno == ENOENT) {
+            throw std::runtime_error("File not found (" + path + ")");
+        }
+        throw std::runtime_error("Problem opening file (" + path + "), " + strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        file_size = static_cast<size_t>(st.st_size);
+    }
+
+    // Detect compression from the first header, without consuming it
+    unsigned char header[GZIP_FIXED_HEADER_BYTES + UINT16_MAX];
+    ssize_t header_len = pread(fd, header, sizeof(header), 0);
+    if (header_len >= 2 && header[0] == GZIP_ID1 && header[1] == GZIP_ID2) {
+        compression = bgzf_block_size(header, static_cast<size_t>(header_len)) ? Compression::BGZF : Compression::GZIP;
+    }
+
+    if (compression == Compression::BGZF) {
+        const size_t num_workers = std::max<size_t>(threads, 1);
+        chunks.resize(num_workers * INPUT_CHUNKS_PER_THREAD + 1);
+        producer = std::thread(&InputStream::read_bgzf_blocks, this);
+        for (size_t i = 0; i < num_workers; ++i) {
+            workers.emplace_back(&InputStream::inflate_bgzf_blocks, this);
+        }
+    }
+    else if (compression == Compression::GZIP) {
+        chunks.resize(INPUT_CHUNKS_PER_THREAD + 1);
+        producer = std::thread(&InputStream::inflate_gzip, this);
+    }
+}
+
+InputStream::~InputStream() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    chunk_freed.notify_all();
+    chunk_compressed.notify_all();
+    if (producer.joinable()) {
+        producer.join();
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    close(fd);
+}
+
+int InputStream::read(void* buf, int len) {
+    if (compression == Compression::NONE) {
+        return read_plain(buf, len);
+    }
+    if (failed()) {
+        return -1;
+    }
+
+    while (true) {
+        Chunk& chunk = chunks[next_chunk % chunks.size()];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            auto chunk_available = [&]() { return chunk.state == ChunkState::READY && chunk.id == next_chunk; };
+            chunk_ready.wait(lock, [&]() { return chunk_available() || (input_done && next_chunk >= num_chunks); });
+            if (!chunk_available()) {
+                return 0; // end of input
+            }
+        }
+
+        if (!chunk.error.empty()) {
+            error = chunk.error;
+            return -1;
+        }
+        if (chunk_pos < chunk.data.size()) {
+            size_t n = std::min(static_cast<size_t>(len), chunk.data.size() - chunk_pos);
+            std::memcpy(buf, chunk.data.data() + chunk_pos, n);
+            chunk_pos += n;
+            return static_cast<int>(n);
+        }
+
+        // Chunk used up, hand its slot back to the producer
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            chunk.state = ChunkState::FREE;
+        }
+        chunk_freed.notify_all();
+        ++next_chunk;
+        chunk_pos = 0;
+    }
+}
+
+int InputStream::read_plain(void* buf, int len) {
+    ssize_t n;
+    do {
+        n = ::read(fd, buf, static_cast<size_t>(len));
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        error = "Problem reading file (" + path + "), " + strerror(errno);
+        return -1;
+    }
+    bytes_consumed.fetch_add(static_cast<size_t>(n), std::memory_order_relaxed);
+    return static_cast<int>(n);
+}
+
+InputStream::Chunk* InputStream::acquire_chunk(size_t id) {
+    std::unique_lock<std::mutex> lock(mutex);
+    // Chunks are read in order, so the slot is free once chunk id - chunks.size() has been read
+    Chunk& chunk = chunks[id % chunks.size()];
+    chunk_freed.wait(lock, [&]() { return stopping || chunk.state == ChunkState::FREE; });
+    if (stopping) {
+        return nullptr;
+    }
+
+    chunk.id = id;
+    chunk.compressed.clear();
+    chunk.data.clear();
+    chunk.error.clear();
+    return &chunk;
+}
+
+void InputStream::publish_chunk(Chunk& chunk, ChunkState state) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        chunk.state = state;
+        if (state == ChunkState::COMPRESSED) {
+            compressed_chunks.push_back(chunk.id % chunks.size());
+        }
+    }
+    if (state == ChunkState::COMPRESSED) {
+        chunk_compressed.notify_one();
+    }
+    else {
+        chunk_ready.notify_one();
+    }
+}
+
+void InputStream::finish_input(size_t total_chunks) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        num_chunks = total_chunks;
+        input_done = true;
+    }
+    chunk_ready.notify_one();
+    chunk_compressed.notify_all();
+}
+
+// Inflates the whole stream on the producer thread, including concatenated members
+void InputStream::inflate_gzip() {
+    z_stream strm{};
+    if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+        // Surface the failure through the first chunk
+        if (Chunk* chunk = acquire_chunk(0)) {
+            chunk->error = "Problem initialising zlib";
+            publish_chunk(*chunk, ChunkState::READY);
+        }
+        finish_input(1);
+        return;
+    }
+
+    std::vector<unsigned char> in(GZIP_READ_BYTES);
+    bool file_done = false;
+    bool member_open = false;
+    bool stream_done = false;
+    size_t id = 0;
+
+    while (!stream_done) {
+        Chunk* chunk = acquire_chunk(id);
+        if (!chunk) {
+            break;
+        }
+        chunk->data.resize(INPUT_CHUNK_BYTES);
+        size_t filled = 0;
+
+        while (filled < chunk->data.size()) {
+            if (strm.avail_in == 0 && !file_done) {
+                ssize_t n = read_full(fd, in.data(), in.size());
+                if (n < 0) {
+                    chunk->error = "Problem reading file (" + path + "), " + strerror(errno);
+                    break;
+                }
+                file_done = n == 0;
+                bytes_consumed.fetch_add(static_cast<size_t>(n), std::memory_order_relaxed);
+                strm.next_in = in.data();
+                strm.avail_in = static_cast<uInt>(n);
+            }
+            if (strm.avail_in == 0 && file_done) {
+                if (member_open) {
+                    chunk->error = "Compressed file is truncated (" + path + ")";
+                }
+                stream_done = true;
+                break;
+            }
+
+            strm.next_out = reinterpret_cast<Bytef*>(chunk->data.data() + filled);
+            strm.avail_out = static_cast<uInt>(chunk->data.size() - filled);
+            member_open = true;
+            int ret = inflate(&strm, Z_NO_FLUSH);
+            filled = chunk->data.size() - strm.avail_out;
+
+            if (ret == Z_STREAM_END) {
+                // Another gzip member may follow
+                member_open = false;
+                inflateReset(&strm);
+            }
+            else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+                chunk->error = "Problem decompressing file (" + path + "), " + (strm.msg ? strm.msg : "invalid gzip data");
+                break;
+            }
+        }
+
+        chunk->data.resize(filled);
+        stream_done = stream_done || !chunk->error.empty();
+        publish_chunk(*chunk, ChunkState::READY);
+        ++id;
+    }
+
+    inflateEnd(&strm);
+    finish_input(id);
+}
+
+// Splits the file into chunks of whole BGZF blocks on the producer thread
+void InputStream::read_bgzf_blocks() {
+    bool file_done = false;
+    size_t id = 0;
+
+    while (!file_done) {
+        Chunk* chunk = acquire_chunk(id);
+        if (!chunk) {
+            break;
+        }
+
+        std::vector<unsigned char>& compressed = chunk->compressed;
+        while (compressed.size() < BGZF_CHUNK_BYTES) {
+            const size_t start = compressed.size();
+            compressed.resize(start + GZIP_FIXED_HEADER_BYTES);
+            ssize_t n = read_full(fd, compressed.data() + start, GZIP_FIXED_HEADER_BYTES);
+            if (n == 0) {
+                compressed.resize(start);
+                file_done = true;
+                break;
+            }
+            if (n < static_cast<ssize_t>(GZIP_FIXED_HEADER_BYTES)) {
+                chunk->error = (n < 0) ? "Problem reading file (" + path + "), " + strerror(errno) : "Compressed file is truncated (" + path + ")";
+                break;
+            }
+
+            const size_t xlen = read_le16(compressed.data() + start + 10);
+            compressed.resize(start + GZIP_FIXED_HEADER_BYTES + xlen);
+            n = read_full(fd, compressed.data() + start + GZIP_FIXED_HEADER_BYTES, xlen);
+            size_t block_size = (n == static_cast<ssize_t>(xlen)) ? bgzf_block_size(compressed.data() + start, GZIP_FIXED_HEADER_BYTES + xlen) : 0;
+            if (block_size < GZIP_FIXED_HEADER_BYTES + xlen + GZIP_FOOTER_BYTES) {
+                chunk->error = "Compressed file has an invalid BGZF block (" + path + ")";
+                break;
+            }
+
+            const size_t remaining = block_size - GZIP_FIXED_HEADER_BYTES - xlen;
+            compressed.resize(start + block_size);
+            n = read_full(fd, compressed.data() + start + GZIP_FIXED_HEADER_BYTES + xlen, remaining);
+            if (n != static_cast<ssize_t>(remaining)) {
+                chunk->error = (n < 0) ? "Problem reading file (" + path + "), " + strerror(errno) : "Compressed file is truncated (" + path + ")";
+                break;
+            }
+            bytes_consumed.fetch_add(block_size, std::memory_order_relaxed);
+        }
+
+        if (!chunk->error.empty()) {
+            file_done = true;
+        }
+        // Errors and empty chunks skip the workers
+        publish_chunk(*chunk, (chunk->error.empty() && !compressed.empty()) ? ChunkState::COMPRESSED : ChunkState::READY);
+        ++id;
+    }
+
+    finish_input(id);
+}
+
+// Worker thread, inflates whole chunks of independent BGZF blocks
+void InputStream::inflate_bgzf_blocks() {
+    z_stream strm{};
+    bool initialised = inflateInit2(&strm, -MAX_WBITS) == Z_OK; // raw deflate, headers are parsed here
+
+    while (true) {
+        size_t slot;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            chunk_compressed.wait(lock, [&]() { return stopping || input_done || !compressed_chunks.empty(); });
+            if (stopping || compressed_chunks.empty()) {
+                break;
+            }
+            slot = compressed_chunks.front();
+            compressed_chunks.pop_front();
+        }
+
+        Chunk& chunk = chunks[slot];
+        const unsigned char* blocks = chunk.compressed.data();
+        const size_t blocks_size = chunk.compressed.size();
+
+        // Every block's footer records its decompressed size, so the output is sized up front
+        size_t total = 0;
+        for (size_t pos = 0; pos < blocks_size; pos += bgzf_block_size(blocks + pos, blocks_size - pos)) {
+            const size_t block_size = bgzf_block_size(blocks + pos, blocks_size - pos);
+            total += read_le32(blocks + pos + block_size - 4);
+        }
+        chunk.data.resize(total);
+
+        if (!initialised) {
+            chunk.error = "Problem initialising zlib";
+        }
+        size_t filled = 0;
+        for (size_t pos = 0; pos < blocks_size && chunk.error.empty(); ) {
+            const size_t block_size = bgzf_block_size(blocks + pos, blocks_size - pos);
+            const size_t data_start = GZIP_FIXED_HEADER_BYTES + read_le16(blocks + pos + 10);
+            const unsigned char* footer = blocks + pos + block_size - GZIP_FOOTER_BYTES;
+            const uint32_t expected_crc = read_le32(footer);
+            const uint32_t block_len = read_le32(footer + 4);
+
+            if (block_len > 0) {
+                inflateReset(&strm);
+                strm.next_in = const_cast<Bytef*>(blocks + pos + data_start);
+                strm.avail_in = static_cast<uInt>(block_size - data_start - GZIP_FOOTER_BYTES);
+                strm.next_out = reinterpret_cast<Bytef*>(chunk.data.data() + filled);
+                strm.avail_out = block_len;
+                int ret = inflate(&strm, Z_FINISH);
+                if (ret != Z_STREAM_END || strm.avail_out != 0) {
+                    chunk.error = "Problem decompressing file (" + path + "), " + (strm.msg ? strm.msg : "invalid BGZF block");
+                    break;
+                }
+                if (crc32(0, reinterpret_cast<const Bytef*>(chunk.data.data() + filled), block_len) != expected_crc) {
+                    chunk.error = "Problem decompressing file (" + path + "), BGZF block checksum mismatch";
+                    break;
+                }
+            }
+            filled += block_len;
+            pos += block_size;
+        }
+
+        publish_chunk(chunk, ChunkState::READY);
+    }
+
+    if (initialised) {
+        inflateEnd(&strm);
+    }
+}
+
+} // namespace kebab
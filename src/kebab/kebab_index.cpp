@@ -9,75 +9,225 @@ KebabIndex<Filter>::KebabIndex(size_t k, size_t expected_kmers, double fp_rate,
     , build_rev_comp(use_build_rev_comp(kmer_mode))
     , scan_rev_comp(use_scan_rev_comp(kmer_mode))
     , bf(expected_kmers, fp_rate, num_hashes, filter_size_mode)
+    , prefetch_distance(PREFETCH_DISTANCE)
+    , partition_shift(0)
+    , partition_locks(BUILD_PARTITIONS)
+    , build_hasher(k, build_rev_comp)
+    , scan_hasher(k, scan_rev_comp)
+    , kernels()
 {
+    init_partitions();
+    select_kernels();
 }
 
 template<typename Filter>
-KebabIndex<Filter>::KebabIndex(std::istream& in) 
+KebabIndex<Filter>::KebabIndex(std::istream& in, uint32_t version, const std::shared_ptr<const MappedFile>& mapping)
     : k(0)
     , kmer_mode(DEFAULT_KMER_MODE)
     , build_rev_comp(use_build_rev_comp(kmer_mode))
     , scan_rev_comp(use_scan_rev_comp(kmer_mode))
     , bf()
+    , prefetch_distance(PREFETCH_DISTANCE)
+    , partition_shift(0)
+    , partition_locks(BUILD_PARTITIONS)
+    , build_hasher()
+    , scan_hasher()
+    , kernels()
 {
-    load(in);
+    load(in, version, mapping);
 }
 
 template<typename Filter>
 void KebabIndex<Filter>::add_sequence(const char* seq, size_t len) {
-    thread_local static NtHash<> build_hasher(k, build_rev_comp);
-
-    build_hasher.set_sequence(seq, len);
-    for (size_t i = 0; i < len - k + 1; ++i) {
-        switch (kmer_mode) {
-            case KmerMode::FORWARD_ONLY:
-                bf.add(build_hasher.hash());
-                break;
-            case KmerMode::BOTH_STRANDS:
-                bf.add(build_hasher.hash());
-                bf.add(build_hasher.hash_rc());
-                break;
-            case KmerMode::CANONICAL_ONLY:
-                bf.add(build_hasher.hash_canonical());
-                break;
-        }
-        build_hasher.unsafe_roll();
+    (this->*kernels.add_sequence)(seq, len);
+}
+
+template<typename Filter>
+template<size_t NumHashes, KmerMode Mode>
+void KebabIndex<Filter>::add_sequence(const char* seq, size_t len) {
+    if constexpr (Mode == KmerMode::BOTH_STRANDS) {
+        build_hasher.template for_each_kmer<false, true>(seq, len, [&](size_t, uint64_t hash, uint64_t hash_rc) {
+            bf.template add<NumHashes>(hash);
+            bf.template add<NumHashes>(hash_rc);
+        });
     }
-    // do {
-    //     bf.add(hasher.hash());
-    // } while (hasher.roll());
+    else {
+        build_hasher.template for_each_kmer<Mode == KmerMode::CANONICAL_ONLY, false>(seq, len, [&](size_t, uint64_t hash, uint64_t) {
+            bf.template add<NumHashes>(hash);
+        });
+    }
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::add_sequence(const char* seq, size_t len, BuildContext& context) {
+    init_context(context);
+    (this->*kernels.add_sequence_buffered)(seq, len, context);
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::add_hashes(const uint64_t* hashes, size_t count, BuildContext& context) {
+    init_context(context);
+    (this->*kernels.add_hashes)(hashes, count, context);
 }
 
 template<typename Filter>
-std::vector<Fragment> KebabIndex<Filter>::scan_read(const char* seq, size_t len, uint64_t min_mem_length, bool remove_overlaps, bool prefetch) {
-    thread_local static NtHash<> scan_hasher(k, scan_rev_comp);
+void KebabIndex<Filter>::init_context(BuildContext& context) const {
+    if (context.counts.empty()) {
+        context.bits.resize(BUILD_PARTITIONS * BUILD_PARTITION_BUFFER);
+        context.counts.assign(BUILD_PARTITIONS, 0);
+    }
+}
 
-    if (prefetch) {
-        return scan_read_prefetch(seq, len, scan_hasher, min_mem_length, remove_overlaps);
+template<typename Filter>
+template<size_t NumHashes, KmerMode Mode>
+void KebabIndex<Filter>::add_sequence_buffered(const char* seq, size_t len, BuildContext& context) {
+    if constexpr (Mode == KmerMode::BOTH_STRANDS) {
+        build_hasher.template for_each_kmer<false, true>(seq, len, [&](size_t, uint64_t hash, uint64_t hash_rc) {
+            buffer_bits<NumHashes>(hash, context);
+            buffer_bits<NumHashes>(hash_rc, context);
+            context.kmers_added += 2;
+        });
     }
     else {
-        return scan_read(seq, len, scan_hasher, min_mem_length, remove_overlaps);
+        build_hasher.template for_each_kmer<Mode == KmerMode::CANONICAL_ONLY, false>(seq, len, [&](size_t, uint64_t hash, uint64_t) {
+            buffer_bits<NumHashes>(hash, context);
+            ++context.kmers_added;
+        });
     }
 }
 
 template<typename Filter>
-std::vector<Fragment> KebabIndex<Filter>::scan_read(const char* seq, size_t len, NtHash<>& scan_hasher, uint64_t min_mem_length, bool remove_overlaps) {
+template<size_t NumHashes>
+void KebabIndex<Filter>::add_hashes(const uint64_t* hashes, size_t count, BuildContext& context) {
+    for (size_t i = 0; i < count; ++i) {
+        buffer_bits<NumHashes>(hashes[i], context);
+    }
+    context.kmers_added += count;
+}
+
+template<typename Filter>
+template<size_t NumHashes>
+inline void KebabIndex<Filter>::buffer_bits(uint64_t hash, BuildContext& context) {
+    bf.template for_each_bit<NumHashes>(hash, [&](uint64_t bit) {
+        const size_t partition = bit >> partition_shift;
+        context.bits[partition * BUILD_PARTITION_BUFFER + context.counts[partition]] = bit;
+        if (++context.counts[partition] == BUILD_PARTITION_BUFFER) {
+            flush_partition(context, partition);
+        }
+    });
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::flush_partition(BuildContext& context, size_t partition) {
+    const uint64_t* bits = &context.bits[partition * BUILD_PARTITION_BUFFER];
+    std::lock_guard<std::mutex> lock(partition_locks[partition]);
+    for (uint32_t i = 0; i < context.counts[partition]; ++i) {
+        bf.set_bit(bits[i]);
+    }
+    context.counts[partition] = 0;
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::finish_build(std::vector<BuildContext>& contexts) {
+    for (BuildContext& context : contexts) {
+        for (size_t partition = 0; partition < context.counts.size(); ++partition) {
+            if (context.counts[partition] > 0) {
+                flush_partition(context, partition);
+            }
+        }
+    }
+    bf.count_set_bits();
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::init_partitions() {
+    // Partitions cover a power of two number of bits and at least a whole block, so no word or block spans two
+    const size_t bits = bf.get_bits();
+    const size_t bits_log2 = (bits > 1) ? 64 - __builtin_clzll(bits - 1) : 0;
+    const size_t partitions_log2 = __builtin_ctzll(BUILD_PARTITIONS);
+    partition_shift = std::max<size_t>(__builtin_ctzll(BLOCK_BITS), (bits_log2 > partitions_log2) ? bits_log2 - partitions_log2 : 0);
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::check_scan_options(uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const {
     if (min_mem_length <= k) {
         throw std::invalid_argument("min_mem_length (" + std::to_string(min_mem_length) + ") must be greater than k (" + std::to_string(k) + ")");
     }
+    if (top_t && remove_overlaps) {
+        throw std::invalid_argument("top_t selection can't remove overlaps");
+    }
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::scan_read(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, bool prefetch, size_t top_t, bool skip_ahead) const {
+    check_scan_options(min_mem_length, remove_overlaps, top_t);
+
+    context.fragments.clear();
+    context.kmers_queried = (len >= k) ? len - k + 1 : 0;
+    context.kmer_misses = 0;
+    ScanKernel kernel;
+    if (skip_ahead) {
+        kernel = prefetch ? kernels.scan_read_skip_prefetch : kernels.scan_read_skip_direct;
+    }
+    else {
+        kernel = prefetch ? kernels.scan_read_prefetch : kernels.scan_read_direct;
+    }
+    (this->*kernel)(seq, len, context, min_mem_length, remove_overlaps, top_t);
+    if (top_t) {
+        finish_top_fragments(context.fragments);
+    }
+}
+
+template<typename Filter>
+std::vector<Fragment> KebabIndex<Filter>::scan_read(const char* seq, size_t len, uint64_t min_mem_length, bool remove_overlaps, bool prefetch, size_t top_t, bool skip_ahead) const {
+    ScanContext context;
+    scan_read(seq, len, context, min_mem_length, remove_overlaps, prefetch, top_t, skip_ahead);
+    return std::move(context.fragments);
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::scan_batch(const Sequence* reads, size_t count, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, bool prefetch, size_t top_t, bool skip_ahead) const {
+    check_scan_options(min_mem_length, remove_overlaps, top_t);
+
+    context.batch_fragments.clear();
+    context.batch_offsets.assign(1, 0);
+    if (prefetch && !skip_ahead) {
+        (this->*kernels.scan_batch_prefetch)(reads, count, context, min_mem_length, remove_overlaps, top_t);
+        return;
+    }
 
-    scan_hasher.set_sequence(seq, len);
-    std::vector<Fragment> fragments;
-    // fragments.reserve(remove_overlaps ? std::ceil(static_cast<double>(len) / min_mem_length) : len - k + 1);
+    // Without a ring there's nothing to keep full, skipping ahead drops its ring at every hit anyway
+    uint64_t kmers_queried = 0;
+    uint64_t kmer_misses = 0;
+    for (size_t i = 0; i < count; ++i) {
+        scan_read(reads[i].seq, reads[i].len, context, min_mem_length, remove_overlaps, prefetch, top_t, skip_ahead);
+        context.batch_fragments.insert(context.batch_fragments.end(), context.fragments.begin(), context.fragments.end());
+        context.batch_offsets.push_back(context.batch_fragments.size());
+        kmers_queried += context.kmers_queried;
+        kmer_misses += context.kmer_misses;
+    }
+    context.kmers_queried = kmers_queried;
+    context.kmer_misses = kmer_misses;
+}
+
+template<typename Filter>
+template<size_t NumHashes, KmerMode Mode>
+void KebabIndex<Filter>::scan_read_direct(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const {
+    std::vector<Fragment>& fragments = context.fragments;
 
     size_t start = 0;
     size_t last_frag_end = 0;
+    size_t head_end = len;
 
     // end is exclusive
     auto update_fragments = [&](size_t frag_end) {
+        head_end = std::min(head_end, frag_end); // ends only grow, so this keeps the first
         if (frag_end - start >= min_mem_length) {
+            if (top_t) {
+                add_top_fragment(fragments, {start, frag_end - start}, top_t);
+            }
             // Check if overlaps the last fragment
-            if (remove_overlaps && start < last_frag_end) {
+            else if (remove_overlaps && start < last_frag_end) {
                 fragments.back().length += frag_end - last_frag_end;
             } else {
                 fragments.push_back({start, frag_end - start});
@@ -86,48 +236,54 @@ std::vector<Fragment> KebabIndex<Filter>::scan_read(const char* seq, size_t len,
         }
     };
 
-    auto check_kmer = [&](size_t pos) {
-        if (!bf.contains(scan_hash(scan_hasher))) {
+    // k-mer identified by position of last character
+    scan_hasher.template for_each_kmer<use_scan_rev_comp(Mode), false>(seq, len, [&](size_t pos, uint64_t hash, uint64_t) {
+        if (!bf.template contains<NumHashes>(hash)) {
             update_fragments(pos);
             start = pos - k + 2; // pos - (k - 1) + 1 -> move to start of k-mer, plus one to move past the offending k-mer
+            ++context.kmer_misses;
         }
-    };
-
-    // k-mer identified by position of last character
-    check_kmer(k - 1); // first doesn't need to be rolled
-    for (size_t i = k; i < len; ++i) {
-        scan_hasher.unsafe_roll();
-        check_kmer(i);
-    }
+    }, [&](size_t first, size_t last) {
+        // K-mers with ambiguous bases are never in the index, only the run's first and last can change the fragments
+        update_fragments(first);
+        start = last - k + 2;
+        context.kmers_queried -= last - first + 1;
+    });
+    context.tail_start = start;
     update_fragments(len);
-
-    return fragments;
+    context.head_end = head_end;
 }
 
 template<typename Filter>
-std::vector<Fragment> KebabIndex<Filter>::scan_read_prefetch(const char* seq, size_t len, NtHash<>& scan_hasher, uint64_t min_mem_length, bool remove_overlaps) {
-    if (min_mem_length <= k) {
-        throw std::invalid_argument("min_mem_length (" + std::to_string(min_mem_length) + ") must be greater than k (" + std::to_string(k) + ")");
+template<size_t NumHashes, KmerMode Mode>
+void KebabIndex<Filter>::scan_read_prefetch(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const {
+    // Based on cache lines touched per lookup to adequately spread out work done when prefetching
+    const size_t NUM_PREFETCH_KMERS = std::max<size_t>(1, prefetch_distance/bf.get_lines_per_lookup());
+    std::vector<PendingKmer>& pending_kmers = context.pending_kmers;
+    if (pending_kmers.size() != NUM_PREFETCH_KMERS || context.num_hashes != bf.get_num_hashes()) {
+        // Only when the context was last used with a differently configured index
+        pending_kmers.assign(NUM_PREFETCH_KMERS, PendingKmer(bf.get_num_hashes()));
+        context.num_hashes = bf.get_num_hashes();
     }
-
-    // Based on number of hashes to adequately spread out work done when prefetching
-    const size_t NUM_PREFETCH_KMERS = PREFETCH_DISTANCE/bf.get_num_hashes();
-    std::vector<PendingKmer> pending_kmers(NUM_PREFETCH_KMERS, PendingKmer(bf.get_num_hashes()));
     size_t pending_head = 0;
     size_t pending_tail = 0;
     size_t pending_count = 0;
 
-    scan_hasher.set_sequence(seq, len);
-    std::vector<Fragment> fragments;
+    std::vector<Fragment>& fragments = context.fragments;
 
     size_t start = 0;
     size_t last_frag_end = 0;
+    size_t head_end = len;
 
     // end is exclusive
     auto update_fragments = [&](size_t frag_end) {
+        head_end = std::min(head_end, frag_end); // ends only grow, so this keeps the first
         if (frag_end - start >= min_mem_length) {
+            if (top_t) {
+                add_top_fragment(fragments, {start, frag_end - start}, top_t);
+            }
             // Check if overlaps the last fragment
-            if (remove_overlaps && start < last_frag_end) {
+            else if (remove_overlaps && start < last_frag_end) {
                 fragments.back().length += frag_end - last_frag_end;
             } else {
                 fragments.push_back({start, frag_end - start});
@@ -137,42 +293,304 @@ std::vector<Fragment> KebabIndex<Filter>::scan_read_prefetch(const char* seq, si
     };
 
     auto remove_pending_kmer = [&]() {
-        if (!bf.check_prefetch(pending_kmers[pending_head].prefetch_info)) {
+        if (!bf.template check_prefetch<NumHashes>(pending_kmers[pending_head].prefetch_info)) {
             update_fragments(pending_kmers[pending_head].pos);
             start = pending_kmers[pending_head].pos - k + 2;
+            ++context.kmer_misses;
         }
-        pending_head = (pending_head + 1) % NUM_PREFETCH_KMERS;
+        pending_head = (pending_head + 1 == NUM_PREFETCH_KMERS) ? 0 : pending_head + 1;
         --pending_count;
     };
 
-    auto add_pending_kmer = [&](size_t pos) {
-        bf.prefetch_words(scan_hash(scan_hasher), pending_kmers[pending_tail].prefetch_info);
+    auto add_pending_kmer = [&](size_t pos, uint64_t hash) {
+        bf.template prefetch_words<NumHashes>(hash, pending_kmers[pending_tail].prefetch_info);
         pending_kmers[pending_tail].pos = pos;
-        pending_tail = (pending_tail + 1) % NUM_PREFETCH_KMERS;
+        pending_tail = (pending_tail + 1 == NUM_PREFETCH_KMERS) ? 0 : pending_tail + 1;
         ++pending_count;
     };
 
-    // Prefetch initial k-mers
-    add_pending_kmer(k - 1); // first doesn't need to be rolled
-    for (size_t i = k; i < k - 1 + NUM_PREFETCH_KMERS && i < len; ++i) {
-        scan_hasher.unsafe_roll();
-        add_pending_kmer(i);
-    }
+    // Prefetch initial k-mers, then check the oldest fetched k-mer before prefetching each next one
+    scan_hasher.template for_each_kmer<use_scan_rev_comp(Mode), false>(seq, len, [&](size_t pos, uint64_t hash, uint64_t) {
+        if (pending_count == NUM_PREFETCH_KMERS) {
+            remove_pending_kmer();
+        }
+        add_pending_kmer(pos, hash);
+    }, [&](size_t first, size_t last) {
+        // Ambiguous k-mers break fragments after every k-mer before them has been checked
+        while (pending_count > 0) {
+            remove_pending_kmer();
+        }
+        update_fragments(first);
+        start = last - k + 2;
+        context.kmers_queried -= last - first + 1;
+    });
 
-    // Check fetched k-mer, prefetch next k-mer
-    for (size_t i = k - 1 + NUM_PREFETCH_KMERS; i < len; ++i) {
-        scan_hasher.unsafe_roll();
+    // Check remaining pending k-mers
+    while (pending_count > 0) {
         remove_pending_kmer();
-        add_pending_kmer(i);
+    }
+    context.tail_start = start;
+    update_fragments(len);
+    context.head_end = head_end;
+}
+
+// The prefetching scan with one ring for the whole batch: each read's k-mers follow the last read's into the ring, and
+// results come out in the same order, so only the read at the ring's head has fragments being built. A read is done
+// once the head moves past its last k-mer. Ambiguous runs go through the ring as markers, to break fragments in order.
+template<typename Filter>
+template<size_t NumHashes, KmerMode Mode>
+void KebabIndex<Filter>::scan_batch_prefetch(const Sequence* reads, size_t count, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const {
+    const size_t NUM_PREFETCH_KMERS = std::max<size_t>(1, prefetch_distance/bf.get_lines_per_lookup());
+    std::vector<PendingKmer>& pending_kmers = context.pending_kmers;
+    if (pending_kmers.size() != NUM_PREFETCH_KMERS || context.num_hashes != bf.get_num_hashes()) {
+        pending_kmers.assign(NUM_PREFETCH_KMERS, PendingKmer(bf.get_num_hashes()));
+        context.num_hashes = bf.get_num_hashes();
+    }
+    size_t pending_head = 0;
+    size_t pending_tail = 0;
+    size_t pending_count = 0;
+
+    std::vector<Fragment>& fragments = context.fragments; // of the read at the head
+    fragments.clear();
+    uint64_t kmers_queried = 0;
+    uint64_t kmer_misses = 0;
+
+    size_t read = 0; // at the head, every read before it is done
+    size_t start = 0;
+    size_t last_frag_end = 0;
+
+    // end is exclusive
+    auto update_fragments = [&](size_t frag_end) {
+        if (frag_end - start >= min_mem_length) {
+            if (top_t) {
+                add_top_fragment(fragments, {start, frag_end - start}, top_t);
+            }
+            // Check if overlaps the last fragment
+            else if (remove_overlaps && start < last_frag_end) {
+                fragments.back().length += frag_end - last_frag_end;
+            } else {
+                fragments.push_back({start, frag_end - start});
+            }
+            last_frag_end = frag_end;
+        }
+    };
+
+    // Finishes reads up to (not including) until, including any too short to have k-mers
+    auto finish_reads = [&](size_t until) {
+        while (read < until) {
+            update_fragments(reads[read].len);
+            if (top_t) {
+                finish_top_fragments(fragments);
+            }
+            context.batch_fragments.insert(context.batch_fragments.end(), fragments.begin(), fragments.end());
+            context.batch_offsets.push_back(context.batch_fragments.size());
+            fragments.clear();
+            start = 0;
+            last_frag_end = 0;
+            ++read;
+        }
+    };
+
+    auto remove_pending_kmer = [&]() {
+        const PendingKmer& pending = pending_kmers[pending_head];
+        finish_reads(pending.read);
+        if (pending.ambiguous) {
+            update_fragments(pending.pos);
+            start = pending.last - k + 2;
+        }
+        else if (!bf.template check_prefetch<NumHashes>(pending.prefetch_info)) {
+            update_fragments(pending.pos);
+            start = pending.pos - k + 2;
+            ++kmer_misses;
+        }
+        pending_head = (pending_head + 1 == NUM_PREFETCH_KMERS) ? 0 : pending_head + 1;
+        --pending_count;
+    };
+
+    auto next_pending_kmer = [&]() -> PendingKmer& {
+        if (pending_count == NUM_PREFETCH_KMERS) {
+            remove_pending_kmer();
+        }
+        PendingKmer& pending = pending_kmers[pending_tail];
+        pending_tail = (pending_tail + 1 == NUM_PREFETCH_KMERS) ? 0 : pending_tail + 1;
+        ++pending_count;
+        return pending;
+    };
+
+    for (size_t r = 0; r < count; ++r) {
+        scan_hasher.template for_each_kmer<use_scan_rev_comp(Mode), false>(reads[r].seq, reads[r].len, [&](size_t pos, uint64_t hash, uint64_t) {
+            PendingKmer& pending = next_pending_kmer();
+            bf.template prefetch_words<NumHashes>(hash, pending.prefetch_info);
+            pending.pos = pos;
+            pending.read = r;
+            pending.ambiguous = false;
+            ++kmers_queried;
+        }, [&](size_t first, size_t last) {
+            PendingKmer& pending = next_pending_kmer();
+            pending.pos = first;
+            pending.last = last;
+            pending.read = r;
+            pending.ambiguous = true;
+        });
     }
 
-    // Check remaining pending k-mers
     while (pending_count > 0) {
         remove_pending_kmer();
     }
-    update_fragments(len);
+    finish_reads(count);
+    context.kmers_queried = kmers_queried;
+    context.kmer_misses = kmer_misses;
+}
 
-    return fragments;
+// A fragment is a maximal run of present k-mers, so one only survives with window = L - k + 1 of them in a row.
+// Any such run starting at or after next covers the k-mer window - 1 past next, so probing that one alone tells
+// whether the window can hold a fragment: a miss rules out the whole window, and the scan jumps past it. Only a hit
+// queries its neighbours, back to next and forward to the run's first miss, each hashed directly where it's needed.
+// Probes along the lattice of windows are independent until one hits, so with Prefetch they're kept in flight.
+template<typename Filter>
+template<size_t NumHashes, KmerMode Mode, bool Prefetch>
+void KebabIndex<Filter>::scan_read_skip(const char* seq, size_t len, ScanContext& context, uint64_t min_mem_length, bool remove_overlaps, size_t top_t) const {
+    constexpr bool CANONICAL = use_scan_rev_comp(Mode);
+    const size_t window = min_mem_length - k + 1;
+
+    const size_t NUM_PREFETCH_KMERS = Prefetch ? std::max<size_t>(1, prefetch_distance/bf.get_lines_per_lookup()) : 1;
+    std::vector<PendingKmer>& pending_kmers = context.pending_kmers;
+    if (pending_kmers.size() < NUM_PREFETCH_KMERS || context.num_hashes != bf.get_num_hashes()) {
+        pending_kmers.assign(NUM_PREFETCH_KMERS, PendingKmer(bf.get_num_hashes()));
+        context.num_hashes = bf.get_num_hashes();
+    }
+
+    std::vector<Fragment>& fragments = context.fragments;
+    std::vector<uint64_t>& hashes = context.hashes;
+    uint64_t kmers_queried = 0;
+    uint64_t kmer_misses = 0;
+
+    size_t start = 0;
+    size_t last_frag_end = 0;
+
+    // end is exclusive
+    auto update_fragments = [&](size_t frag_end) {
+        if (frag_end - start >= min_mem_length) {
+            if (top_t) {
+                add_top_fragment(fragments, {start, frag_end - start}, top_t);
+            }
+            // Check if overlaps the last fragment
+            else if (remove_overlaps && start < last_frag_end) {
+                fragments.back().length += frag_end - last_frag_end;
+            } else {
+                fragments.push_back({start, frag_end - start});
+            }
+            last_frag_end = frag_end;
+        }
+    };
+
+    // Hashes of the k-mers ending at first through last
+    auto hash_kmers = [&](size_t first, size_t last) {
+        hashes.resize(last - first + 1);
+        scan_hasher.hash_all(seq + first + 1 - k, last - first + k, hashes.data(), nullptr, CANONICAL);
+        return hashes.data();
+    };
+
+    auto contains = [&](uint64_t hash) {
+        ++kmers_queried;
+        const bool present = bf.template contains<NumHashes>(hash);
+        kmer_misses += !present;
+        return present;
+    };
+
+    // Runs between ambiguous bases are scanned on their own, k-mers spanning an ambiguous base are never present
+    size_t run_start = 0;
+    while (run_start + k <= len) {
+        const size_t run_end = NtHash<>::find_ambiguous(seq, run_start, len);
+        if (run_end - run_start + 1 >= k + window) {
+            const size_t last = run_end - 1;  // position of the run's last k-mer
+            size_t next = run_start + k - 1;  // first k-mer not yet known, the one before it is absent or ambiguous
+            size_t lattice = next;            // first k-mer of the window probed next
+            size_t pending_head = 0;
+            size_t pending_tail = 0;
+            size_t pending_count = 0;
+
+            while (true) {
+                while (pending_count < NUM_PREFETCH_KMERS && lattice + window - 1 <= last) {
+                    const size_t probe = lattice + window - 1;
+                    uint64_t hash;
+                    scan_hasher.hash_all(seq + probe + 1 - k, k, &hash, nullptr, CANONICAL);
+                    bf.template prefetch_words<NumHashes>(hash, pending_kmers[pending_tail].prefetch_info);
+                    pending_kmers[pending_tail].pos = probe;
+                    pending_tail = (pending_tail + 1 == NUM_PREFETCH_KMERS) ? 0 : pending_tail + 1;
+                    ++pending_count;
+                    lattice = probe + 1;
+                }
+                if (pending_count == 0) {
+                    break;
+                }
+
+                const size_t probe = pending_kmers[pending_head].pos;
+                ++kmers_queried;
+                const bool present = bf.template check_prefetch<NumHashes>(pending_kmers[pending_head].prefetch_info);
+                pending_head = (pending_head + 1 == NUM_PREFETCH_KMERS) ? 0 : pending_head + 1;
+                --pending_count;
+                if (!present) {
+                    ++kmer_misses;
+                    next = probe + 1;
+                    continue;
+                }
+
+                // Extend the run through the probe back to next, then forward to its first miss
+                size_t run_first = probe;
+                if (probe > next) {
+                    const uint64_t* back = hash_kmers(next, probe - 1);
+                    while (run_first > next && contains(back[run_first - 1 - next])) {
+                        --run_first;
+                    }
+                }
+                size_t run_last = probe;
+                bool extending = true;
+                while (extending && run_last < last) {
+                    const size_t chunk_first = run_last + 1;
+                    const uint64_t* forward = hash_kmers(chunk_first, std::min(last, run_last + window));
+                    for (size_t i = 0; i < hashes.size(); ++i) {
+                        if (!contains(forward[i])) {
+                            extending = false;
+                            break;
+                        }
+                        ++run_last;
+                    }
+                }
+                if (run_last - run_first + 1 >= window) {
+                    start = run_first + 1 - k;
+                    update_fragments(run_last + 1);
+                }
+
+                // Probes in flight were placed for the old lattice, which restarts past the run's miss
+                next = run_last + 2;
+                lattice = next;
+                pending_head = pending_tail;
+                pending_count = 0;
+            }
+        }
+        run_start = run_end + 1;
+    }
+
+    context.kmers_queried = kmers_queried;
+    context.kmer_misses = kmer_misses;
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::merge(const KebabIndex& other) {
+    if (k != other.k) {
+        throw std::invalid_argument("Indexes differ in k (" + std::to_string(k) + " vs " + std::to_string(other.k) + ")");
+    }
+    if (kmer_mode != other.kmer_mode) {
+        throw std::invalid_argument(std::string("Indexes differ in k-mer mode (") + kmer_mode_name(kmer_mode) + " vs " + kmer_mode_name(other.kmer_mode) + ")");
+    }
+    bf.merge(other.bf);
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::fold() {
+    bf.fold();
+    init_partitions();
 }
 
 template<typename Filter>
@@ -189,16 +607,63 @@ void KebabIndex<Filter>::save(std::ostream& out) const {
 }
 
 template<typename Filter>
-void KebabIndex<Filter>::load(std::istream& in) {
+void KebabIndex<Filter>::load(std::istream& in, uint32_t version, const std::shared_ptr<const MappedFile>& mapping) {
     in.read(reinterpret_cast<char*>(&k), sizeof(k));
     in.read(reinterpret_cast<char*>(&kmer_mode), sizeof(kmer_mode));
     build_rev_comp = use_build_rev_comp(kmer_mode);
     scan_rev_comp = use_scan_rev_comp(kmer_mode);
-    bf.load(in);
+    build_hasher = NtHash<>(k, build_rev_comp);
+    scan_hasher = NtHash<>(k, scan_rev_comp);
+    bf.load(in, version, mapping);
+    init_partitions();
+    select_kernels();
+}
+
+template<typename Filter>
+template<size_t NumHashes, KmerMode Mode>
+constexpr typename KebabIndex<Filter>::Kernels KebabIndex<Filter>::specialised_kernels() {
+    return {
+        &KebabIndex::add_sequence<NumHashes, Mode>,
+        &KebabIndex::add_sequence_buffered<NumHashes, Mode>,
+        &KebabIndex::add_hashes<NumHashes>,
+        &KebabIndex::scan_read_direct<NumHashes, Mode>,
+        &KebabIndex::scan_read_prefetch<NumHashes, Mode>,
+        &KebabIndex::scan_read_skip<NumHashes, Mode, false>,
+        &KebabIndex::scan_read_skip<NumHashes, Mode, true>,
+        &KebabIndex::scan_batch_prefetch<NumHashes, Mode>
+    };
+}
+
+template<typename Filter>
+template<size_t... NumHashes>
+constexpr std::array<std::array<typename KebabIndex<Filter>::Kernels, NUM_KMER_MODES>, sizeof...(NumHashes)> KebabIndex<Filter>::kernel_table(std::index_sequence<NumHashes...>) {
+    // Columns follow the declaration order of KmerMode
+    return {{
+        {{
+            specialised_kernels<NumHashes, KmerMode::BOTH_STRANDS>(),
+            specialised_kernels<NumHashes, KmerMode::CANONICAL_ONLY>(),
+            specialised_kernels<NumHashes, KmerMode::FORWARD_ONLY>()
+        }}...
+    }};
+}
+
+template<typename Filter>
+void KebabIndex<Filter>::select_kernels() {
+    // Row 0 loops over the filter's hash count at runtime, row n is unrolled for exactly n hashes
+    static constexpr auto KERNELS = kernel_table(std::make_index_sequence<MAX_SPECIALISED_HASHES + 1>());
+
+    const size_t mode = static_cast<size_t>(kmer_mode);
+    if (mode >= NUM_KMER_MODES) {
+        throw std::runtime_error("Unknown k-mer mode (" + std::to_string(mode) + ") in index");
+    }
+    const size_t num_hashes = bf.get_num_hashes();
+    kernels = KERNELS[num_hashes <= MAX_SPECIALISED_HASHES ? num_hashes : 0][mode];
 }
 
 // Explicit instantiation
 template class KebabIndex<ShiftFilter>;
 template class KebabIndex<ModFilter>;
+template class KebabIndex<BlockedShiftFilter>;
+template class KebabIndex<BlockedModFilter>;
 
 } // namespace kebab
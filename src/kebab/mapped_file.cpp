@@ -0,0 +1,65 @@
+#include "kebab/mapped_file.hpp"
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace kebab {
+
+MappedFile::MappedFile(const std::string& path, MapOptions options)
+    : addr(nullptr)
+    , len(0)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Problem opening file (" + path + "), " + strerror(errno));
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        throw std::runtime_error("Problem reading file size (" + path + "), " + strerror(err));
+    }
+    len = static_cast<size_t>(st.st_size);
+    if (len == 0) {
+        close(fd);
+        throw std::runtime_error("Cannot map empty file (" + path + ")");
+    }
+
+    int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+    if (options.populate) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+
+    void* mapped = mmap(nullptr, len, PROT_READ, flags, fd, 0);
+    int err = errno;
+    close(fd); // mapping holds its own reference to the file
+    if (mapped == MAP_FAILED) {
+        throw std::runtime_error("Problem mapping file (" + path + "), " + strerror(err));
+    }
+    addr = static_cast<char*>(mapped);
+
+    // Hints only, failures are not fatal
+    // Bloom filter lookups are uniformly random, so readahead only wastes I/O unless prefaulting everything
+    madvise(addr, len, options.populate ? MADV_WILLNEED : MADV_RANDOM);
+#ifdef MADV_HUGEPAGE
+    if (options.huge_pages) {
+        madvise(addr, len, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+MappedFile::~MappedFile() {
+    if (addr) {
+        munmap(addr, len);
+    }
+}
+
+} // namespace kebab
@@ -1,6 +1,10 @@
 /* Implemented from the paper/codebase of https://github.com/bcgsc/ntHash */
 #include "kebab/nt_hash.hpp"
 
+#include <cstring>
+#include <type_traits>
+#include <immintrin.h>
+
 namespace {
 template<typename T>
 struct NtMap;
@@ -99,10 +103,263 @@ struct NtMap<uint32_t> {
 
 template<typename T>
 constexpr size_t BITS_IN_TYPE = CHAR_BIT * sizeof(T);
+
+// =============================================
+// Vector kernels (64-bit hashes only)
+// =============================================
+// Consecutive k-mers are hashed a vector at a time from the last known hash. With d_m the change contributed by
+// step m (outgoing and incoming base), the hash j + 1 steps ahead is rol(h, j + 1) ^ XOR_{m<=j} rol(d_m, j - m),
+// and the XOR term is a prefix scan computed in log2(lanes) shift/rotate steps. The reverse complement is the same with ror.
+
+// Table index of a base is (c >> 1) & 3, which is A,C,T,G for both cases; other bytes are masked to 0 like NtMap
+struct alignas(64) LaneTables {
+    uint64_t fwd[8];
+    uint64_t fwd_k[8];
+    uint64_t rc[8];
+    uint64_t rc_k[8];
+
+    explicit LaneTables(size_t k) : fwd{}, fwd_k{}, rc{}, rc_k{} {
+        const uint64_t bases[4] = {NtMap<uint64_t>::A, NtMap<uint64_t>::C, NtMap<uint64_t>::T, NtMap<uint64_t>::G};
+        const uint64_t bases_rc[4] = {NtMap<uint64_t>::T, NtMap<uint64_t>::G, NtMap<uint64_t>::A, NtMap<uint64_t>::C};
+        for (size_t c = 0; c < 4; ++c) {
+            fwd[c] = bases[c];
+            fwd_k[c] = (bases[c] << k) | (bases[c] >> (64 - k));
+            rc[c] = bases_rc[c];
+            rc_k[c] = (bases_rc[c] << k) | (bases_rc[c] >> (64 - k));
+        }
+    }
+};
+
+const LaneTables& lane_tables(size_t k) {
+    thread_local static size_t tables_k = 0;
+    thread_local static LaneTables tables(1);
+    if (tables_k != k) {
+        tables = LaneTables(k);
+        tables_k = k;
+    }
+    return tables;
+}
+
+// Bits 'a', 'c', 'g' and 't' counted from 'a'
+constexpr int64_t VALID_LETTERS = (1LL << 0) | (1LL << ('c' - 'a')) | (1LL << ('g' - 'a')) | (1LL << ('t' - 'a'));
+
+// ---------- AVX2, 4 lanes ----------
+
+struct Avx2Bases {
+    __m256i index;
+    __m256i valid;
+};
+
+__attribute__((target("avx2")))
+inline Avx2Bases load_bases_avx2(const char* seq) {
+    int32_t packed;
+    std::memcpy(&packed, seq, sizeof(packed));
+    const __m256i c = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+    const __m256i letter = _mm256_sub_epi64(_mm256_or_si256(c, _mm256_set1_epi64x(0x20)), _mm256_set1_epi64x('a'));
+    const __m256i valid = _mm256_sub_epi64(_mm256_setzero_si256(),
+        _mm256_and_si256(_mm256_srlv_epi64(_mm256_set1_epi64x(VALID_LETTERS), letter), _mm256_set1_epi64x(1)));
+    // 64-bit entry i is 32-bit entries 2i and 2i + 1
+    const __m256i lo = _mm256_and_si256(c, _mm256_set1_epi64x(0x6));
+    const __m256i hi = _mm256_add_epi64(lo, _mm256_set1_epi64x(1));
+    return {_mm256_or_si256(lo, _mm256_slli_epi64(hi, 32)), valid};
+}
+
+__attribute__((target("avx2")))
+inline __m256i lookup_avx2(__m256i table, const Avx2Bases& bases) {
+    return _mm256_and_si256(_mm256_permutevar8x32_epi32(table, bases.index), bases.valid);
+}
+
+__attribute__((target("avx2")))
+inline __m256i rol_avx2(__m256i v, int n) {
+    return _mm256_or_si256(_mm256_slli_epi64(v, n), _mm256_srli_epi64(v, 64 - n));
+}
+
+__attribute__((target("avx2")))
+inline __m256i ror_avx2(__m256i v, int n) {
+    return _mm256_or_si256(_mm256_srli_epi64(v, n), _mm256_slli_epi64(v, 64 - n));
+}
+
+__attribute__((target("avx2")))
+inline __m256i shift_lanes_avx2(__m256i v, int lanes) {
+    // lane j takes lane j - lanes, vacated lanes are zero
+    if (lanes == 1) {
+        return _mm256_blend_epi32(_mm256_permute4x64_epi64(v, _MM_SHUFFLE(2, 1, 0, 0)), _mm256_setzero_si256(), 0x03);
+    }
+    return _mm256_blend_epi32(_mm256_permute4x64_epi64(v, _MM_SHUFFLE(1, 0, 0, 0)), _mm256_setzero_si256(), 0x0F);
+}
+
+__attribute__((target("avx2")))
+inline __m256i min_epu64_avx2(__m256i a, __m256i b) {
+    const __m256i sign = _mm256_set1_epi64x(static_cast<int64_t>(1ULL << 63));
+    const __m256i a_gt_b = _mm256_cmpgt_epi64(_mm256_xor_si256(a, sign), _mm256_xor_si256(b, sign));
+    return _mm256_blendv_epi8(a, b, a_gt_b);
+}
+
+// Extends out[i] (hash h, h_rc) as far as whole vectors allow, returns the last index written
+__attribute__((target("avx2")))
+size_t roll_lanes_avx2(const char* seq, size_t num_kmers, size_t k, uint64_t& h, uint64_t& h_rc, uint64_t* out, uint64_t* out_rc, bool canonical) {
+    const LaneTables& tables = lane_tables(k);
+    const __m256i fwd = _mm256_load_si256(reinterpret_cast<const __m256i*>(tables.fwd));
+    const __m256i fwd_k = _mm256_load_si256(reinterpret_cast<const __m256i*>(tables.fwd_k));
+    const __m256i rc = _mm256_load_si256(reinterpret_cast<const __m256i*>(tables.rc));
+    const __m256i rc_k = _mm256_load_si256(reinterpret_cast<const __m256i*>(tables.rc_k));
+    const __m256i steps = _mm256_setr_epi64x(1, 2, 3, 4);
+    const __m256i back_steps = _mm256_sub_epi64(_mm256_set1_epi64x(64), steps);
+    const bool need_rc = canonical || out_rc;
+
+    __m256i hb = _mm256_set1_epi64x(static_cast<int64_t>(h));
+    __m256i hb_rc = _mm256_set1_epi64x(static_cast<int64_t>(h_rc));
+    size_t i = 0;
+    for (; i + 4 < num_kmers; i += 4) {
+        const Avx2Bases outgoing = load_bases_avx2(seq + i);
+        const Avx2Bases incoming = load_bases_avx2(seq + i + k);
+
+        __m256i d = _mm256_xor_si256(lookup_avx2(fwd_k, outgoing), lookup_avx2(fwd, incoming));
+        d = _mm256_xor_si256(d, rol_avx2(shift_lanes_avx2(d, 1), 1));
+        d = _mm256_xor_si256(d, rol_avx2(shift_lanes_avx2(d, 2), 2));
+        const __m256i hashes = _mm256_xor_si256(_mm256_or_si256(_mm256_sllv_epi64(hb, steps), _mm256_srlv_epi64(hb, back_steps)), d);
+        hb = _mm256_permute4x64_epi64(hashes, _MM_SHUFFLE(3, 3, 3, 3));
+
+        __m256i hashes_rc = hashes;
+        if (need_rc) {
+            __m256i e = _mm256_xor_si256(lookup_avx2(rc, outgoing), lookup_avx2(rc_k, incoming));
+            e = _mm256_xor_si256(e, ror_avx2(shift_lanes_avx2(e, 1), 1));
+            e = _mm256_xor_si256(e, ror_avx2(shift_lanes_avx2(e, 2), 2));
+            hashes_rc = _mm256_xor_si256(_mm256_or_si256(_mm256_srlv_epi64(hb_rc, steps), _mm256_sllv_epi64(hb_rc, back_steps)), ror_avx2(e, 1));
+            hb_rc = _mm256_permute4x64_epi64(hashes_rc, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 1), canonical ? min_epu64_avx2(hashes, hashes_rc) : hashes);
+        if (out_rc) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out_rc + i + 1), hashes_rc);
+        }
+    }
+
+    h = static_cast<uint64_t>(_mm256_extract_epi64(hb, 0));
+    h_rc = static_cast<uint64_t>(_mm256_extract_epi64(hb_rc, 0));
+    return i;
+}
+
+// ---------- AVX-512, 8 lanes ----------
+
+// GCC 12 reports the placeholder operands inside its own AVX-512 intrinsics as uninitialised when not using LTO
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+struct Avx512Bases {
+    __m512i index;
+    __mmask8 valid;
+};
+
+__attribute__((target("avx512f")))
+inline Avx512Bases load_bases_avx512(const char* seq) {
+    const __m512i c = _mm512_cvtepu8_epi64(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(seq)));
+    // Bit (c | 0x20) - 'a' of VALID_LETTERS is set for a/c/g/t in either case, shifts out of range give 0
+    const __m512i letter = _mm512_sub_epi64(_mm512_or_si512(c, _mm512_set1_epi64(0x20)), _mm512_set1_epi64('a'));
+    const __mmask8 valid = _mm512_test_epi64_mask(_mm512_srlv_epi64(_mm512_set1_epi64(VALID_LETTERS), letter), _mm512_set1_epi64(1));
+    return {_mm512_srli_epi64(c, 1), valid}; // permutes only read the low 3 bits, masked lanes cover the rest
+}
+
+__attribute__((target("avx512f")))
+inline __m512i lookup_avx512(__m512i table, const Avx512Bases& bases) {
+    return _mm512_maskz_permutexvar_epi64(bases.valid, _mm512_and_si512(bases.index, _mm512_set1_epi64(3)), table);
+}
+
+__attribute__((target("avx512f")))
+inline __m512i shift_lanes_avx512(__m512i v, int lanes) {
+    // lane j takes lane j - lanes, vacated lanes are zero
+    const __m512i idx = _mm512_sub_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7), _mm512_set1_epi64(lanes));
+    return _mm512_maskz_permutexvar_epi64(static_cast<__mmask8>(0xFF << lanes), idx, v);
+}
+
+__attribute__((target("avx512f")))
+size_t roll_lanes_avx512(const char* seq, size_t num_kmers, size_t k, uint64_t& h, uint64_t& h_rc, uint64_t* out, uint64_t* out_rc, bool canonical) {
+    const LaneTables& tables = lane_tables(k);
+    const __m512i fwd = _mm512_load_si512(tables.fwd);
+    const __m512i fwd_k = _mm512_load_si512(tables.fwd_k);
+    const __m512i rc = _mm512_load_si512(tables.rc);
+    const __m512i rc_k = _mm512_load_si512(tables.rc_k);
+    const __m512i steps = _mm512_setr_epi64(1, 2, 3, 4, 5, 6, 7, 8);
+    const __m512i last_lane = _mm512_set1_epi64(7);
+    const bool need_rc = canonical || out_rc;
+
+    __m512i hb = _mm512_set1_epi64(static_cast<int64_t>(h));
+    __m512i hb_rc = _mm512_set1_epi64(static_cast<int64_t>(h_rc));
+    size_t i = 0;
+    for (; i + 8 < num_kmers; i += 8) {
+        const Avx512Bases outgoing = load_bases_avx512(seq + i);
+        const Avx512Bases incoming = load_bases_avx512(seq + i + k);
+
+        __m512i d = _mm512_xor_si512(lookup_avx512(fwd_k, outgoing), lookup_avx512(fwd, incoming));
+        d = _mm512_xor_si512(d, _mm512_rol_epi64(shift_lanes_avx512(d, 1), 1));
+        d = _mm512_xor_si512(d, _mm512_rol_epi64(shift_lanes_avx512(d, 2), 2));
+        d = _mm512_xor_si512(d, _mm512_rol_epi64(shift_lanes_avx512(d, 4), 4));
+        const __m512i hashes = _mm512_xor_si512(_mm512_rolv_epi64(hb, steps), d);
+        hb = _mm512_permutexvar_epi64(last_lane, hashes);
+
+        __m512i hashes_rc = hashes;
+        if (need_rc) {
+            __m512i e = _mm512_xor_si512(lookup_avx512(rc, outgoing), lookup_avx512(rc_k, incoming));
+            e = _mm512_xor_si512(e, _mm512_ror_epi64(shift_lanes_avx512(e, 1), 1));
+            e = _mm512_xor_si512(e, _mm512_ror_epi64(shift_lanes_avx512(e, 2), 2));
+            e = _mm512_xor_si512(e, _mm512_ror_epi64(shift_lanes_avx512(e, 4), 4));
+            hashes_rc = _mm512_xor_si512(_mm512_rorv_epi64(hb_rc, steps), _mm512_ror_epi64(e, 1));
+            hb_rc = _mm512_permutexvar_epi64(last_lane, hashes_rc);
+        }
+
+        _mm512_storeu_si512(out + i + 1, canonical ? _mm512_min_epu64(hashes, hashes_rc) : hashes);
+        if (out_rc) {
+            _mm512_storeu_si512(out_rc + i + 1, hashes_rc);
+        }
+    }
+
+    h = static_cast<uint64_t>(_mm_cvtsi128_si64(_mm512_castsi512_si128(hb)));
+    h_rc = static_cast<uint64_t>(_mm_cvtsi128_si64(_mm512_castsi512_si128(hb_rc)));
+    return i;
 }
 
+#pragma GCC diagnostic pop
+
+// Has 0x80 in exactly the bytes of v that are zero
+inline uint64_t zero_bytes(uint64_t v) noexcept {
+    constexpr uint64_t LOW_7 = 0x7F7F7F7F7F7F7F7FULL;
+    return ~(((v & LOW_7) + LOW_7) | v | LOW_7);
+}
+
+inline bool is_base(uint8_t c) noexcept {
+    c |= 0x20;
+    return c == 'a' || c == 'c' || c == 'g' || c == 't';
+}
+
+} // namespace
+
 namespace kebab {
 
+template<typename T>
+size_t NtHash<T>::find_ambiguous(const char* seq, size_t from, size_t len) noexcept {
+    // Eight bases at a time: lowercased, a byte is a base if it equals one of a/c/g/t
+    constexpr uint64_t ONES = 0x0101010101010101ULL;
+    constexpr uint64_t HIGH = 0x8080808080808080ULL;
+    size_t i = from;
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, seq + i, sizeof(word));
+        word |= 0x20 * ONES;
+        const uint64_t bases = zero_bytes(word ^ ('a' * ONES)) | zero_bytes(word ^ ('c' * ONES))
+                             | zero_bytes(word ^ ('g' * ONES)) | zero_bytes(word ^ ('t' * ONES));
+        if (bases != HIGH) {
+            return i + __builtin_ctzll(~bases & HIGH) / CHAR_BIT; // little endian, first byte lowest
+        }
+    }
+    for (; i < len; ++i) {
+        if (!is_base(static_cast<uint8_t>(seq[i]))) {
+            return i;
+        }
+    }
+    return len;
+}
+
 template<typename T>
 NtHash<T>::NtHash(size_t k, bool rev_comp) noexcept
     : k(k)
@@ -174,6 +431,77 @@ void NtHash<T>::unsafe_roll() noexcept {
     ++pos;
 }
 
+template<typename T>
+void NtHash<T>::hash_all(const char* seq, size_t len, T* out, T* out_rc, bool canonical, HashKernel kernel) const noexcept {
+    if (len < k) {
+        return;
+    }
+    const size_t num_kmers = len - k + 1;
+    const bool need_rc = canonical || out_rc;
+
+    // Roll the first k-mer in from an empty hash
+    T h = 0;
+    T h_rc = 0;
+    for (size_t i = 0; i < k; ++i) {
+        uint8_t incoming = static_cast<uint8_t>(seq[i]);
+        h = rol(h, 1) ^ NtMap<T>::map[incoming];
+        if (need_rc) {
+            h_rc = ror(h_rc ^ rol_k_map_rc[incoming], 1);
+        }
+    }
+    out[0] = canonical ? std::min(h, h_rc) : h;
+    if (out_rc) {
+        out_rc[0] = h_rc;
+    }
+
+    size_t i = 0;
+    if constexpr (std::is_same_v<T, uint64_t>) {
+        static const HashKernel supported = detect_hash_kernel();
+        // The 4-lane AVX2 kernel measures slower than the scalar loop, so it is only used on request
+        if (kernel == HashKernel::AUTO) {
+            kernel = supported == HashKernel::AVX512 ? HashKernel::AVX512 : HashKernel::SCALAR;
+        }
+        else if (kernel > supported) {
+            kernel = supported; // requested kernel not available on this CPU
+        }
+        if (kernel == HashKernel::AVX512) {
+            i = roll_lanes_avx512(seq, num_kmers, k, h, h_rc, out, out_rc, canonical);
+        }
+        else if (kernel == HashKernel::AVX2) {
+            i = roll_lanes_avx2(seq, num_kmers, k, h, h_rc, out, out_rc, canonical);
+        }
+    }
+
+    // Scalar remainder, a loop per mode keeps the canonical min branch-free
+    auto roll = [&](size_t next) {
+        uint8_t outgoing = static_cast<uint8_t>(seq[next - 1]);
+        uint8_t incoming = static_cast<uint8_t>(seq[next - 1 + k]);
+        h = rol(h, 1) ^ rol_k_map[outgoing] ^ NtMap<T>::map[incoming];
+        if (need_rc) {
+            h_rc = ror(h_rc ^ NtMap<T>::map_rc[outgoing] ^ rol_k_map_rc[incoming], 1);
+        }
+    };
+    if (canonical) {
+        for (++i; i < num_kmers; ++i) {
+            roll(i);
+            out[i] = h < h_rc ? h : h_rc;
+        }
+    }
+    else if (out_rc) {
+        for (++i; i < num_kmers; ++i) {
+            roll(i);
+            out[i] = h;
+            out_rc[i] = h_rc;
+        }
+    }
+    else {
+        for (++i; i < num_kmers; ++i) {
+            roll(i);
+            out[i] = h;
+        }
+    }
+}
+
 template<typename T>
 void NtHash<T>::init_rol_k_map() noexcept {
     rol_k_map['A'] = rol(NtMap<T>::map['A'], k);
@@ -208,6 +536,27 @@ T NtHash<T>::ror(T v, size_t n) noexcept {
     return (v >> n) | (v << (BITS_IN_TYPE<T> - n));
 }
 
+HashKernel detect_hash_kernel() noexcept {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return HashKernel::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        return HashKernel::AVX2;
+    }
+    return HashKernel::SCALAR;
+}
+
+const char* hash_kernel_name(HashKernel kernel) noexcept {
+    switch (kernel) {
+        case HashKernel::AUTO: return "auto";
+        case HashKernel::SCALAR: return "scalar";
+        case HashKernel::AVX2: return "avx2";
+        case HashKernel::AVX512: return "avx512";
+    }
+    return "unknown";
+}
+
 // Explicit instantiation
 template class NtHash<uint64_t>;
 template class NtHash<uint32_t>;
@@ -0,0 +1,120 @@
+#include "kebab/output_writer.hpp"
+
+#include <chrono>
+
+namespace kebab {
+
+OutputWriter::OutputWriter(FILE* out, size_t num_buffers, bool ordered)
+    : out(out)
+    , ordered(ordered)
+    , slots(num_buffers)
+    , free_slots()
+    , ready_slots()
+    , next_id(0)
+    , done(false)
+    , failed(false)
+    , write_nanos(0)
+{
+    for (size_t i = 0; i < slots.size(); ++i) {
+        slots[i].buffer.slot = i;
+        free_slots.push_back(i);
+    }
+    writer = std::thread(&OutputWriter::run, this);
+}
+
+OutputWriter::~OutputWriter() {
+    finish();
+}
+
+OutputBuffer& OutputWriter::acquire(size_t id) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    size_t index;
+    if (ordered) {
+        // Each id has a fixed slot, and may only take it once every id a full window behind has been written
+        index = id % slots.size();
+        slot_freed.wait(lock, [&]() { return id < next_id + slots.size() && slots[index].state == SlotState::FREE; });
+    }
+    else {
+        slot_freed.wait(lock, [&]() { return !free_slots.empty(); });
+        index = free_slots.front();
+        free_slots.pop_front();
+    }
+
+    slots[index].state = SlotState::FILLING;
+    slots[index].id = id;
+    return slots[index].buffer;
+}
+
+void OutputWriter::submit(OutputBuffer& buffer) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[buffer.slot].state = SlotState::READY;
+        if (!ordered) {
+            ready_slots.push_back(buffer.slot);
+        }
+    }
+    slot_ready.notify_one();
+}
+
+bool OutputWriter::finish() {
+    if (writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            done = true;
+        }
+        slot_ready.notify_one();
+        writer.join();
+    }
+    return !failed;
+}
+
+void OutputWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    auto next_ready = [&]() {
+        if (ordered) {
+            const Slot& slot = slots[next_id % slots.size()];
+            return slot.state == SlotState::READY && slot.id == next_id;
+        }
+        return !ready_slots.empty();
+    };
+
+    while (true) {
+        slot_ready.wait(lock, [&]() { return next_ready() || done; });
+        if (!next_ready()) {
+            break; // done, and everything submitted has been written
+        }
+
+        size_t index;
+        if (ordered) {
+            index = next_id % slots.size();
+        }
+        else {
+            index = ready_slots.front();
+            ready_slots.pop_front();
+        }
+
+        // Write outside the lock so workers can keep acquiring and submitting
+        lock.unlock();
+        OutputBuffer& buffer = slots[index].buffer;
+        if (!buffer.empty() && !failed) {
+            const auto start_time = std::chrono::steady_clock::now();
+            failed = fwrite(buffer.c_str(), 1, buffer.size(), out) != buffer.size();
+            write_nanos += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+        }
+        buffer.clear();
+        lock.lock();
+
+        slots[index].state = SlotState::FREE;
+        if (ordered) {
+            ++next_id;
+        }
+        else {
+            free_slots.push_back(index);
+        }
+        slot_freed.notify_all();
+    }
+}
+
+} // namespace kebab
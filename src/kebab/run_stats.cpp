@@ -0,0 +1,129 @@
+#include "kebab/run_stats.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <cmath>
+
+namespace kebab {
+
+namespace {
+
+constexpr const char* PHASE_NAMES[NUM_PHASES] = {
+    "parse", "parse_wait", "input_wait", "sketch", "insert", "lookup", "select", "format", "output_wait", "write"
+};
+
+double ratio(uint64_t num, uint64_t den) noexcept {
+    return den ? static_cast<double>(num) / den : 0.0;
+}
+
+} // namespace
+
+RunStats::RunStats(bool timed, size_t threads, size_t outputs)
+    : timed(timed)
+    , start_time(std::chrono::steady_clock::now())
+    , workers(threads)
+    , io()
+    , values()
+{
+    for (ThreadStats& stats : workers) {
+        stats.outputs.resize(outputs);
+    }
+    restart();
+}
+
+void RunStats::restart() noexcept {
+    if (!timed) {
+        return;
+    }
+    for (ThreadStats& stats : workers) {
+        stats.start();
+    }
+    for (ThreadStats& stats : io) {
+        stats.start();
+    }
+}
+
+void RunStats::set(const std::string& name, double value) {
+    values.emplace_back(name, value);
+}
+
+void RunStats::write_json(const std::string& path, const std::string& command, const std::vector<uint64_t>& min_mem_lengths) const {
+    const double wall_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    ThreadStats total;
+    total.outputs.resize(min_mem_lengths.size());
+    auto add = [&](const ThreadStats& stats) {
+        total.reads += stats.reads;
+        total.bases += stats.bases;
+        total.kmers += stats.kmers;
+        total.kmer_misses += stats.kmer_misses;
+        for (size_t o = 0; o < total.outputs.size() && o < stats.outputs.size(); ++o) {
+            total.outputs[o].fragments += stats.outputs[o].fragments;
+            total.outputs[o].bases += stats.outputs[o].bases;
+        }
+        for (size_t p = 0; p < NUM_PHASES; ++p) {
+            total.phase_nanos[p] += stats.phase_nanos[p];
+        }
+    };
+    for (const ThreadStats& stats : workers) {
+        add(stats);
+    }
+    for (const ThreadStats& stats : io) {
+        add(stats);
+    }
+
+    std::ofstream out(path);
+    if (!out) {
+        throw std::runtime_error("Problem opening stats file (" + path + ")");
+    }
+    out << std::fixed << std::setprecision(6);
+    out << "{\n";
+    out << "  \"command\": \"" << command << "\",\n";
+    out << "  \"version\": \"" << VERSION << "\",\n";
+    out << "  \"threads\": " << workers.size() << ",\n";
+    out << "  \"wall_seconds\": " << wall_seconds << ",\n";
+    out << "  \"reads\": " << total.reads << ",\n";
+    out << "  \"bases\": " << total.bases << ",\n";
+    out << "  \"reads_per_second\": " << (wall_seconds > 0 ? total.reads / wall_seconds : 0.0) << ",\n";
+    out << "  \"bases_per_second\": " << (wall_seconds > 0 ? total.bases / wall_seconds : 0.0) << ",\n";
+    if (command == "scan") {
+        out << "  \"kmers_queried\": " << total.kmers << ",\n";
+        out << "  \"kmer_hits\": " << total.kmers - total.kmer_misses << ",\n";
+        out << "  \"hit_ratio\": " << ratio(total.kmers - total.kmer_misses, total.kmers) << ",\n";
+        out << "  \"outputs\": [";
+        for (size_t o = 0; o < total.outputs.size(); ++o) {
+            out << (o ? ",\n" : "\n");
+            out << "    {\"min_mem_length\": " << min_mem_lengths[o]
+                << ", \"fragments\": " << total.outputs[o].fragments
+                << ", \"fragment_bases\": " << total.outputs[o].bases
+                << ", \"retention_ratio\": " << ratio(total.outputs[o].bases, total.bases) << "}";
+        }
+        out << "\n  ],\n";
+    }
+    else {
+        out << "  \"kmers_inserted\": " << total.kmers << ",\n";
+    }
+    for (const auto& value : values) {
+        out << "  \"" << value.first << "\": ";
+        if (value.second == std::floor(value.second) && std::fabs(value.second) < 1e15) {
+            out << static_cast<int64_t>(value.second) << ",\n";
+        }
+        else {
+            out << value.second << ",\n";
+        }
+    }
+    // Summed over threads, so a phase can take longer than the run
+    out << "  \"thread_seconds\": {";
+    for (size_t p = 0; p < NUM_PHASES; ++p) {
+        out << (p ? ",\n" : "\n") << "    \"" << PHASE_NAMES[p] << "\": " << total.phase_nanos[p] / 1e9;
+    }
+    out << "\n  }\n";
+    out << "}\n";
+
+    if (!out) {
+        throw std::runtime_error("Problem writing stats file (" + path + ")");
+    }
+}
+
+} // namespace kebab
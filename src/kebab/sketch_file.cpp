@@ -0,0 +1,79 @@
+#include "kebab/sketch_file.hpp"
+#include "kebab/file_util.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+namespace kebab {
+
+namespace {
+
+struct SketchHeader {
+    uint32_t magic = SKETCH_FILE_MAGIC;
+    uint32_t version = SKETCH_FILE_VERSION;
+    uint64_t kmer_size = 0;
+    KmerMode kmer_mode = DEFAULT_KMER_MODE;
+    uint32_t np = 0;        // log2 of the number of registers
+    uint64_t file_size = 0; // of the sketched file
+    int64_t file_mtime = 0;
+};
+
+} // namespace
+
+std::string sketch_path(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode) {
+    return fasta_file + ".k" + std::to_string(kmer_size) + "." + kmer_mode_name(kmer_mode) + SKETCH_FILE_SUFFIX;
+}
+
+bool load_sketch(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode, hll::hll_t& hll) {
+    std::ifstream in(sketch_path(fasta_file, kmer_size, kmer_mode), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    SketchHeader header;
+    in.read(reinterpret_cast<char*>(&header.magic), sizeof(header.magic));
+    in.read(reinterpret_cast<char*>(&header.version), sizeof(header.version));
+    in.read(reinterpret_cast<char*>(&header.kmer_size), sizeof(header.kmer_size));
+    in.read(reinterpret_cast<char*>(&header.kmer_mode), sizeof(header.kmer_mode));
+    in.read(reinterpret_cast<char*>(&header.np), sizeof(header.np));
+    in.read(reinterpret_cast<char*>(&header.file_size), sizeof(header.file_size));
+    in.read(reinterpret_cast<char*>(&header.file_mtime), sizeof(header.file_mtime));
+
+    uint64_t file_size;
+    int64_t file_mtime;
+    if (!in || header.magic != SKETCH_FILE_MAGIC || header.version != SKETCH_FILE_VERSION
+        || header.kmer_size != kmer_size || header.kmer_mode != kmer_mode || header.np != hll.get_np()
+        || !stat_file(fasta_file, file_size, file_mtime) || header.file_size != file_size || header.file_mtime != file_mtime) {
+        return false;
+    }
+
+    hll.read(in);
+    if (!in) {
+        hll.clear();
+        return false;
+    }
+    return true;
+}
+
+void save_sketch(const std::string& fasta_file, uint16_t kmer_size, KmerMode kmer_mode, const hll::hll_t& hll) {
+    SketchHeader header;
+    header.kmer_size = kmer_size;
+    header.kmer_mode = kmer_mode;
+    header.np = static_cast<uint32_t>(hll.get_np());
+    if (!stat_file(fasta_file, header.file_size, header.file_mtime)) {
+        throw std::runtime_error("Problem inspecting " + fasta_file + " to save its sketch");
+    }
+
+    write_file_atomically(sketch_path(fasta_file, kmer_size, kmer_mode), "sketch", [&](std::ostream& out) {
+        out.write(reinterpret_cast<const char*>(&header.magic), sizeof(header.magic));
+        out.write(reinterpret_cast<const char*>(&header.version), sizeof(header.version));
+        out.write(reinterpret_cast<const char*>(&header.kmer_size), sizeof(header.kmer_size));
+        out.write(reinterpret_cast<const char*>(&header.kmer_mode), sizeof(header.kmer_mode));
+        out.write(reinterpret_cast<const char*>(&header.np), sizeof(header.np));
+        out.write(reinterpret_cast<const char*>(&header.file_size), sizeof(header.file_size));
+        out.write(reinterpret_cast<const char*>(&header.file_mtime), sizeof(header.file_mtime));
+        hll.write(out);
+    });
+}
+
+} // namespace kebab
@@ -0,0 +1,106 @@
+#include "kebab/tune_file.hpp"
+#include "kebab/file_util.hpp"
+
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+namespace kebab {
+
+namespace {
+
+struct TuneHeader {
+    uint32_t magic = TUNE_FILE_MAGIC;
+    uint32_t version = TUNE_FILE_VERSION;
+    uint64_t file_size = 0; // of the tuned index
+    int64_t file_mtime = 0;
+    uint32_t num_procs = 0;
+    std::string cpu;
+};
+
+// Model name of the first processor, settings tuned on one model say little about another
+std::string cpu_model() {
+    std::ifstream in("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.compare(0, 10, "model name") == 0) {
+            const size_t colon = line.find(':');
+            return (colon == std::string::npos) ? line : line.substr(colon + 1);
+        }
+    }
+    return "unknown";
+}
+
+TuneHeader machine_header() {
+    TuneHeader header;
+    header.num_procs = std::thread::hardware_concurrency();
+    header.cpu = cpu_model().substr(0, TUNE_MAX_CPU_NAME);
+    return header;
+}
+
+} // namespace
+
+std::string tune_path(const std::string& index_file) {
+    return index_file + TUNE_FILE_SUFFIX;
+}
+
+bool load_tune(const std::string& index_file, TuneResult& result) {
+    std::ifstream in(tune_path(index_file), std::ios::binary);
+    if (!in) {
+        return false;
+    }
+
+    TuneHeader header;
+    uint32_t cpu_len = 0;
+    in.read(reinterpret_cast<char*>(&header.magic), sizeof(header.magic));
+    in.read(reinterpret_cast<char*>(&header.version), sizeof(header.version));
+    in.read(reinterpret_cast<char*>(&header.file_size), sizeof(header.file_size));
+    in.read(reinterpret_cast<char*>(&header.file_mtime), sizeof(header.file_mtime));
+    in.read(reinterpret_cast<char*>(&header.num_procs), sizeof(header.num_procs));
+    in.read(reinterpret_cast<char*>(&cpu_len), sizeof(cpu_len));
+    if (!in || header.magic != TUNE_FILE_MAGIC || header.version != TUNE_FILE_VERSION || cpu_len > TUNE_MAX_CPU_NAME) {
+        return false;
+    }
+    header.cpu.resize(cpu_len);
+    in.read(header.cpu.data(), cpu_len);
+
+    uint64_t prefetch_distance = 0;
+    uint16_t threads = 0;
+    in.read(reinterpret_cast<char*>(&prefetch_distance), sizeof(prefetch_distance));
+    in.read(reinterpret_cast<char*>(&threads), sizeof(threads));
+
+    const TuneHeader machine = machine_header();
+    uint64_t file_size;
+    int64_t file_mtime;
+    if (!in || threads == 0 || header.num_procs != machine.num_procs || header.cpu != machine.cpu
+        || !stat_file(index_file, file_size, file_mtime) || header.file_size != file_size || header.file_mtime != file_mtime) {
+        return false;
+    }
+
+    result.prefetch_distance = prefetch_distance;
+    result.threads = threads;
+    return true;
+}
+
+void save_tune(const std::string& index_file, const TuneResult& result) {
+    TuneHeader header = machine_header();
+    if (!stat_file(index_file, header.file_size, header.file_mtime)) {
+        throw std::runtime_error("Problem inspecting " + index_file + " to save its tuning");
+    }
+    const uint32_t cpu_len = static_cast<uint32_t>(header.cpu.size());
+    const uint64_t prefetch_distance = result.prefetch_distance;
+
+    write_file_atomically(tune_path(index_file), "tuning", [&](std::ostream& out) {
+        out.write(reinterpret_cast<const char*>(&header.magic), sizeof(header.magic));
+        out.write(reinterpret_cast<const char*>(&header.version), sizeof(header.version));
+        out.write(reinterpret_cast<const char*>(&header.file_size), sizeof(header.file_size));
+        out.write(reinterpret_cast<const char*>(&header.file_mtime), sizeof(header.file_mtime));
+        out.write(reinterpret_cast<const char*>(&header.num_procs), sizeof(header.num_procs));
+        out.write(reinterpret_cast<const char*>(&cpu_len), sizeof(cpu_len));
+        out.write(header.cpu.data(), cpu_len);
+        out.write(reinterpret_cast<const char*>(&prefetch_distance), sizeof(prefetch_distance));
+        out.write(reinterpret_cast<const char*>(&result.threads), sizeof(result.threads));
+    });
+}
+
+} // namespace kebab